@@ -6,14 +6,247 @@
 #include <vector>
 #include <stdexcept>
 #include <bitset>
+#include <mutex>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 using namespace std;
 
+Board::SliderMagic Board::bishopMagics[64];
+Board::SliderMagic Board::rookMagics[64];
+uint64_t Board::sliderAttackTable[5248 + 102400];
+Board::SliderBackend Board::sliderBackend = Board::SliderBackend::Magic;
+uint64_t Board::knightAttacks[64];
+uint64_t Board::kingAttackTable[64];
+uint64_t Board::pawnAttackTable[2][64];
+uint64_t Board::betweenMasks[64][64];
+uint64_t Board::lineMasks[64][64];
+uint64_t Board::zobristPieceSquare[12][64];
+uint64_t Board::zobristCastling[16];
+int Board::castlingRightsMask[64];
+uint64_t Board::zobristEnPassantFile[8];
+uint64_t Board::zobristBlackToMove;
+
+// PEXT as inline assembly rather than _pext_u64(): the intrinsic only inlines into functions compiled for BMI2,
+// which would turn every slider lookup into a call. Only reached through the Pext instantiations below,
+// which the public functions pick once cpuHasFastPext() said yes
+#if defined(__x86_64__)
+static inline uint64_t pextIndex(uint64_t blockers, uint64_t mask) {
+    uint64_t index;
+    asm("pextq %2, %1, %0" : "=r"(index) : "r"(blockers), "rm"(mask));
+    return index;
+}
+#else
+static inline uint64_t pextIndex(uint64_t, uint64_t) {
+    return 0;
+}
+#endif
+
+// The backend is a template parameter, so the choice is made once at the top of a public function
+// instead of at every lookup
+static constexpr Board::SliderBackend PEXT = Board::SliderBackend::Pext;
+static constexpr Board::SliderBackend MAGIC = Board::SliderBackend::Magic;
+
+template<Board::SliderBackend B>
+static inline uint64_t sliderIndex(const Board::SliderMagic& m, uint64_t blockers) {
+    if (B == PEXT) {
+        return pextIndex(blockers, m.mask);
+    }
+    return ((blockers & m.mask) * m.magic) >> m.shift;
+}
+
+bool Board::cpuHasFastPext() {
+#if defined(__x86_64__)
+    if (!__builtin_cpu_supports("bmi2")) {
+        return false;
+    }
+
+    // AMD before Zen 3 (family 19h) implements PEXT in microcode, which is slower than the magic multiply.
+    // Hygon's Dhyana is a Zen 1 licensed from AMD (family 18h), so it gets the same test
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    bool isAMD = (ebx == 0x68747541);   // "Auth" of "AuthenticAMD"
+    bool isHygon = (ebx == 0x6F677948); // "Hygo" of "HygonGenuine"
+    if (isAMD || isHygon) {
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+        unsigned int family = ((eax >> 8) & 0xF) + ((eax >> 20) & 0xFF);
+        return family >= 0x19;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* Board::sliderBackendName() {
+    return sliderBackend == SliderBackend::Pext ? "PEXT (BMI2)" : "Magic bitboards";
+}
+
 
 void Board::precomputeAttackBitboards() {
+    // The attack and geometry tables are shared by every board, so they only have to be built once
+    static std::once_flag tablesBuilt;
+    std::call_once(tablesBuilt, buildAttackTables);
+}
+
+void Board::buildAttackTables() {
     for (int square = 0; square < 64; ++square) {
         knightAttacks[square] = generateKnightAttacks(square);
     }
+
+    initZobristKeys();
+
+    for (int square = 0; square < 64; ++square) {
+        castlingRightsMask[square] = WHITE_KING_SIDE | WHITE_QUEEN_SIDE | BLACK_KING_SIDE | BLACK_QUEEN_SIDE;
+    }
+    castlingRightsMask[60] &= ~(WHITE_KING_SIDE | WHITE_QUEEN_SIDE); // e1
+    castlingRightsMask[63] &= ~WHITE_KING_SIDE;                      // h1
+    castlingRightsMask[56] &= ~WHITE_QUEEN_SIDE;                     // a1
+    castlingRightsMask[4] &= ~(BLACK_KING_SIDE | BLACK_QUEEN_SIDE);  // e8
+    castlingRightsMask[7] &= ~BLACK_KING_SIDE;                       // h8
+    castlingRightsMask[0] &= ~BLACK_QUEEN_SIDE;                      // a8
+
+    sliderBackend = cpuHasFastPext() ? SliderBackend::Pext : SliderBackend::Magic;
+    uint64_t* next = initSliderMagics(bishopMagics, sliderAttackTable, true);
+    initSliderMagics(rookMagics, next, false);
+
+    for (int square = 0; square < 64; ++square) {
+        uint64_t bitboard = 1ULL << square;
+        kingAttackTable[square] = generateKingAttacks(square);
+
+        // White pawns capture towards rank 8 (lower indices), black pawns towards rank 1
+        pawnAttackTable[0][square] = ((bitboard >> 9) & ~FILE_A) | ((bitboard >> 7) & ~FILE_H);
+        pawnAttackTable[1][square] = ((bitboard << 7) & ~FILE_A) | ((bitboard << 9) & ~FILE_H);
+    }
+
+    for (int square1 = 0; square1 < 64; ++square1) {
+        for (int square2 = 0; square2 < 64; ++square2) {
+            uint64_t bitboard1 = 1ULL << square1;
+            uint64_t bitboard2 = 1ULL << square2;
+            betweenMasks[square1][square2] = 0ULL;
+            lineMasks[square1][square2] = 0ULL;
+
+            if (square1 == square2) continue;
+
+            // Two squares share a line if a slider on one of them sees the other on an empty board
+            if (generateBishopAttacks(square1, 0) & bitboard2) {
+                betweenMasks[square1][square2] = generateBishopAttacks(square1, bitboard2) & generateBishopAttacks(square2, bitboard1);
+                lineMasks[square1][square2] = (generateBishopAttacks(square1, 0) & generateBishopAttacks(square2, 0)) | bitboard1 | bitboard2;
+            } else if (generateRookAttacks(square1, 0) & bitboard2) {
+                betweenMasks[square1][square2] = generateRookAttacks(square1, bitboard2) & generateRookAttacks(square2, bitboard1);
+                lineMasks[square1][square2] = (generateRookAttacks(square1, 0) & generateRookAttacks(square2, 0)) | bitboard1 | bitboard2;
+            }
+        }
+    }
+}
+
+// Fixed seed, so a position gets the same key on every run
+void Board::initZobristKeys() {
+    uint64_t seed = 1070372ULL;
+    auto random = [&seed]() {
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        return seed * 2685821657736338717ULL;
+    };
+
+    for (int pieceType = 0; pieceType < 12; ++pieceType) {
+        for (int square = 0; square < 64; ++square) {
+            zobristPieceSquare[pieceType][square] = random();
+        }
+    }
+    uint64_t castlingRightKeys[4];
+    for (int i = 0; i < 4; ++i) {
+        castlingRightKeys[i] = random();
+    }
+    for (int rights = 0; rights < 16; ++rights) {
+        zobristCastling[rights] = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (rights & (1 << i)) {
+                zobristCastling[rights] ^= castlingRightKeys[i];
+            }
+        }
+    }
+    for (int file = 0; file < 8; ++file) {
+        zobristEnPassantFile[file] = random();
+    }
+    zobristBlackToMove = random();
+}
+
+// Finds a magic number for every square by trial and error and fills that square's slice of the table
+// (with the PEXT backend the slice is filled in PEXT order and no search is needed).
+// Returns the first free entry after the last slice so the next piece type can carry on from there.
+uint64_t* Board::initSliderMagics(SliderMagic magics[], uint64_t* table, bool bishop) {
+    uint64_t occupancies[4096];
+    uint64_t references[4096];
+    int epoch[4096] = {0};
+    int attempt = 0;
+
+    // xorshift64* reseeded for every square, so the same magics are found on every run.
+    // The seeds were picked per rank as the ones that find magics in the fewest attempts
+    static const uint64_t rankSeeds[8] = { 728, 1110, 786, 341, 1026, 199, 1055, 255 };
+    uint64_t seed = 0;
+    auto random = [&seed]() {
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        return seed * 2685821657736338717ULL;
+    };
+
+    for (int square = 0; square < 64; ++square) {
+        SliderMagic& m = magics[square];
+        seed = rankSeeds[square / 8];
+
+        // Squares on the edge of the board never block anything further along the ray
+        uint64_t edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * (square / 8))))
+                       | ((FILE_H | FILE_A) & ~(FILE_H << (square % 8)));
+        m.mask = (bishop ? slidingBishopAttacks(square, 0) : slidingRookAttacks(square, 0)) & ~edges;
+        int bits = popCount(m.mask);
+        m.shift = 64 - bits;
+        m.attacks = table;
+
+        // Carry-Rippler trick to walk every subset of the mask
+        int size = 0;
+        uint64_t subset = 0;
+        do {
+            occupancies[size] = subset;
+            references[size] = bishop ? slidingBishopAttacks(square, subset) : slidingRookAttacks(square, subset);
+            size++;
+            subset = (subset - m.mask) & m.mask;
+        } while (subset);
+
+        if (sliderBackend == SliderBackend::Pext) {
+            m.magic = 0;
+            for (int i = 0; i < size; ++i) {
+                m.attacks[pextIndex(occupancies[i], m.mask)] = references[i];
+            }
+            table += size;
+            continue;
+        }
+
+        // Keep trying sparse random numbers until no two subsets with different attacks share an index
+        for (int i = 0; i < size; ) {
+            do {
+                m.magic = random() & random() & random();
+            } while (popCount((m.mask * m.magic) >> 56) < 6);
+
+            ++attempt;
+            for (i = 0; i < size; ++i) {
+                unsigned index = unsigned((occupancies[i] * m.magic) >> m.shift);
+                if (epoch[index] < attempt) {
+                    epoch[index] = attempt;
+                    m.attacks[index] = references[i];
+                } else if (m.attacks[index] != references[i]) {
+                    break;
+                }
+            }
+        }
+
+        table += size;
+    }
+    return table;
 }
 
 void Board::setupInitialPosition() {
@@ -34,17 +267,16 @@ void Board::setupInitialPosition() {
     bitboards[9] = 0x0000000000000081ULL; // Black Rooks
     bitboards[10] = 0x0000000000000008ULL; // Black Queen
     bitboards[11] = 0x0000000000000010ULL; // Black King
+    rebuildCachedBoards();
 
 
-
-    whiteKingSideCastling = true;
-    whiteQueenSideCastling = true;
-    blackKingSideCastling = true;
-    blackQueenSideCastling = true;
+    castlingRights = WHITE_KING_SIDE | WHITE_QUEEN_SIDE | BLACK_KING_SIDE | BLACK_QUEEN_SIDE;
     enPassantSquare = -1;
     halfmoveClock = 0;
-    fullmoveNumber = 0;
+    fullmoveNumber = 1;
     whiteToMove = true;
+    st = nullptr;
+    hashKey = computeHashKey();
 }
 
 // Function to split a string by a delimiter
@@ -58,7 +290,7 @@ vector<string> Board::split(const string& str, char delimiter) {
     return tokens;
 }
 
-void Board::setupPosition(const std::string& fen) {
+void Board::setupPosition(const std::string& fen, StateInfo* rootState) {
     vector<string> splitString = split(fen, ' '); // split the board from other FEN variables
     if (splitString.size() != 6) {
         throw invalid_argument("Invalid FEN Notation");
@@ -107,13 +339,16 @@ void Board::setupPosition(const std::string& fen) {
             throw invalid_argument("Invalid FEN Notation");
         }
     }
+    rebuildCachedBoards();
+
     // Setup additional FEN variables
     whiteToMove = (splitString[1].find('w') != string::npos);
-    string castlingRights = splitString[2];
-    whiteKingSideCastling = castlingRights.find('K') != string::npos;
-    whiteQueenSideCastling = castlingRights.find('Q') != string::npos;
-    blackKingSideCastling = castlingRights.find('k') != string::npos;
-    blackQueenSideCastling = castlingRights.find('q') != string::npos;
+    string castling = splitString[2];
+    castlingRights = 0;
+    if (castling.find('K') != string::npos) castlingRights |= WHITE_KING_SIDE;
+    if (castling.find('Q') != string::npos) castlingRights |= WHITE_QUEEN_SIDE;
+    if (castling.find('k') != string::npos) castlingRights |= BLACK_KING_SIDE;
+    if (castling.find('q') != string::npos) castlingRights |= BLACK_QUEEN_SIDE;
     
     string enPassant = splitString[3];
     enPassantSquare = (enPassant == "-") ? -1 : coordinateToBitboardIndex(enPassant);
@@ -122,20 +357,58 @@ void Board::setupPosition(const std::string& fen) {
 
     // The fullmoveNumber can be used as needed; it's not included here
     fullmoveNumber = stoi(splitString[5]);
+
+    st = rootState;
+    if (st) {
+        st->previous = nullptr;
+        st->positionInfo.valid = false;
+        st->checkInfo.valid = false;
+    }
+    hashKey = computeHashKey();
+}
+
+void Board::rebuildCachedBoards() {
+    fill(begin(pieceOnSquare), end(pieceOnSquare), -1);
+    occupancy[0] = bitboards[0] | bitboards[1] | bitboards[2] | bitboards[3] | bitboards[4] | bitboards[5];
+    occupancy[1] = bitboards[6] | bitboards[7] | bitboards[8] | bitboards[9] | bitboards[10] | bitboards[11];
+    occupied = occupancy[0] | occupancy[1];
+    for (int pieceType = 0; pieceType < 12; ++pieceType) {
+        uint64_t pieces = bitboards[pieceType];
+        while (pieces) {
+            pieceOnSquare[__builtin_ctzll(pieces)] = pieceType;
+            pieces &= pieces - 1;
+        }
+    }
 }
 
 // Move a piece from one square to another
 void Board::movePiece(int pieceType, int fromSquare, int toSquare) {
+    int colour = pieceType < 6 ? 0 : 1;
     bitboards[pieceType] &= ~(1ULL << fromSquare); // Clear the original square
     bitboards[pieceType] |= (1ULL << toSquare);    // Set the destination square
+    occupancy[colour] &= ~(1ULL << fromSquare);
+    occupancy[colour] |= (1ULL << toSquare);
+    occupied &= ~(1ULL << fromSquare);
+    occupied |= (1ULL << toSquare);
+    hashKey ^= zobristPieceSquare[pieceType][fromSquare] ^ zobristPieceSquare[pieceType][toSquare];
+    pieceOnSquare[fromSquare] = -1;
+    pieceOnSquare[toSquare] = pieceType;
 }
 
 void Board::removePiece(int pieceType, int square) {
     bitboards[pieceType] &= ~(1ULL << square);
+    occupancy[pieceType < 6 ? 0 : 1] &= ~(1ULL << square);
+    occupied &= ~(1ULL << square);
+    pieceOnSquare[square] = -1;
+    hashKey ^= zobristPieceSquare[pieceType][square];
 }
 
 void Board::addPiece(int pieceType, int square) {
     bitboards[pieceType] |= (1ULL << square);
+    occupancy[pieceType < 6 ? 0 : 1] |= (1ULL << square);
+    occupied |= (1ULL << square);
+    pieceOnSquare[square] = pieceType;
+    hashKey ^= zobristPieceSquare[pieceType][square];
 }
 
 void Board::printFENBoard() {
@@ -158,10 +431,10 @@ void Board::printFENBoard() {
     }
 
     std:: cout << "White to move: " << (whiteToMove ? "true" : "false") << std::endl;
-    std:: cout << "White King Side Castling: " << (whiteKingSideCastling ? "true" : "false") << std::endl;
-    std:: cout << "White Queen Side Castling: " << (whiteQueenSideCastling ? "true" : "false") << std::endl;
-    std:: cout << "Black King Side Castling: " << (blackKingSideCastling ? "true" : "false") << std::endl;
-    std:: cout << "Black Queen Side Castling: " << (blackQueenSideCastling ? "true" : "false") << std::endl;
+    std:: cout << "White King Side Castling: " << ((castlingRights & WHITE_KING_SIDE) ? "true" : "false") << std::endl;
+    std:: cout << "White Queen Side Castling: " << ((castlingRights & WHITE_QUEEN_SIDE) ? "true" : "false") << std::endl;
+    std:: cout << "Black King Side Castling: " << ((castlingRights & BLACK_KING_SIDE) ? "true" : "false") << std::endl;
+    std:: cout << "Black Queen Side Castling: " << ((castlingRights & BLACK_QUEEN_SIDE) ? "true" : "false") << std::endl;
     std:: cout << "En Passant Square: " << enPassantSquare << std::endl;
     std:: cout << "Halfmove Clock: " << halfmoveClock << std::endl;
     std:: cout << "Fullmove Number: " << fullmoveNumber << std::endl;
@@ -249,114 +522,135 @@ int Board::coordinateToBitboardIndex(const std::string& coordinate) const {
 }
 
 
-int Board::pieceTypeAtSquare(int square) {
-    for (int pieceType = 0; pieceType < 12; ++pieceType) {
-        if (bitboards[pieceType] & (1ULL << square)) {
-            return pieceType;
-        }
+// makeMove() doesn't change the side to move (callers flipColour() themselves), so it dispatches on the colour of the moving piece
+void Board::makeMove(const Move& move, StateInfo& state) {
+    if (pieceOnSquare[move.getFromSquare()] < 6) {
+        makeMoveFor<WHITE>(move, state);
+    } else {
+        makeMoveFor<BLACK>(move, state);
     }
-    return -1;
 }
 
-void Board::makeMove(const Move& move) {
+template<Color Us>
+void Board::makeMoveFor(const Move& move, StateInfo& state) {
     int fromSquare = move.getFromSquare();
     int toSquare = move.getToSquare();
-    int pieceType = move.getPieceType();
+    int pieceType = pieceTypeAtSquare(fromSquare);
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
     Move::MoveType moveType = move.getMoveType();
 
+    // Save the state this move is about to overwrite. The board now points at this StateInfo, whose analysis is
+    // worked out for the position after the move when it is first asked for
+    state.previous = st;
+    state.positionInfo.valid = false;
+    state.checkInfo.valid = false;
+    st = &state;
+    state.hashKey = hashKey;
+    state.capturedPieceType = -1;
+    state.enPassantSquare = enPassantSquare;
+    state.castlingRights = castlingRights;
+    state.halfmoveClock = halfmoveClock;
+
     switch(moveType) {
         case Move::MoveType::Normal:
-            //std:: cout << "Normal move executing\n";
             movePiece(pieceType, fromSquare, toSquare);
             break;
             
         case Move::MoveType::MovedTwice:
-            //std:: cout << "Moved Twice Executing\n";
             movePiece(pieceType, fromSquare, toSquare);
             break;
             
         case Move::MoveType::Capture:
-            //std:: cout << " Capture Executing\n";
-            removePiece(move.getCapturedPieceType(), toSquare);
+            state.capturedPieceType = pieceTypeAtSquare(toSquare);
+            removePiece(state.capturedPieceType, toSquare);
             movePiece(pieceType, fromSquare, toSquare);
             break;
             
         case Move::MoveType::EnPassantCapture:
-            //std:: cout << "En Passant Capture Executing\n";
-            if(pieceType == 0) { // checks whether the piece is white pawn
-                removePiece(6, move.getEnPassantSquare() + 8);
+            if(Us == WHITE) { // white pawn takes en passant
+                state.capturedPieceType = 6;
+                removePiece(6, toSquare + 8);
             } else {
-                removePiece(0, move.getEnPassantSquare() - 8);
+                state.capturedPieceType = 0;
+                removePiece(0, toSquare - 8);
             }
-            movePiece(pieceType, fromSquare, move.getEnPassantSquare());
+            movePiece(pieceType, fromSquare, toSquare);
             break;
             
         case Move::MoveType::Promote:
-            //std:: cout << "Promote Executing\n";
             removePiece(pieceType, fromSquare);
-            addPiece(move.getPromotedPieceType(), toSquare);
+            addPiece(playerPieceType + move.getPromotedPiece(), toSquare);
             break;
             
         case Move::MoveType::PromoteCapture:
-            //std:: cout << "Promote Capture Executing\n";
+            state.capturedPieceType = pieceTypeAtSquare(toSquare);
             removePiece(pieceType, fromSquare);
-            removePiece(move.getCapturedPieceType(), toSquare);
-            addPiece(move.getPromotedPieceType(), toSquare);
+            removePiece(state.capturedPieceType, toSquare);
+            addPiece(playerPieceType + move.getPromotedPiece(), toSquare);
             break;
             
         case Move::MoveType::CastleKingSide:
-            //std:: cout << "Castle King Side Executing\n";
-            if (pieceType == 5) { // checks whether the piece is white king
-                bitboards[5] = 0;
-                bitboards[5] = ( 1ULL << toSquare);
-                //movePiece(5, fromSquare, toSquare); // move the white king
+            movePiece(pieceType, fromSquare, toSquare); // move the king
+            if (Us == WHITE) { // white king castles
                 movePiece(3, 63, 61); // move the white rook
-                whiteKingSideCastling = false;
-                whiteQueenSideCastling = false;
             } else {
-                bitboards[11] = 0;
-                bitboards[11] = (1ULL << toSquare);
-                //movePiece(11, fromSquare, toSquare); // move the black king
                 movePiece(9, 7, 5); // move the black rook
-                blackKingSideCastling = false;
-                blackQueenSideCastling = false;
             }
             break;
             
         case Move::MoveType::CastleQueenSide:
-            //std:: cout << "Castle Queen Side Executing\n";
-            if (pieceType == 5) { // checks whether the piece is white king
-                bitboards[5] = 0;
-                bitboards[5] = (1ULL << toSquare);
-                //movePiece(5, fromSquare, toSquare); // move the white king
+            movePiece(pieceType, fromSquare, toSquare); // move the king
+            if (Us == WHITE) { // white king castles
                 movePiece(3, 56, 59); // move the white rook
-                whiteKingSideCastling = false;
-                whiteQueenSideCastling = false;
             } else {
-                bitboards[11] = 0;
-                bitboards[11] = (1ULL << toSquare);
-                //movePiece(11, fromSquare, toSquare); // move the black king
                 movePiece(9, 0, 3); // move the black rook
-                blackKingSideCastling = false;
-                blackQueenSideCastling = false;
             }
             break;
             
         default:
             throw std::invalid_argument("Unknown MoveType");
 
-        // whiteToMove = !whiteToMove;
-        // Full move clocks etc Todo
+    }
+
+    // The en passant square and castling rights are hashed as a whole: take the old ones out, put the new ones in
+    hashKey ^= castlingKey() ^ enPassantKey();
 
+    // A double pawn push leaves the square it skipped open for en passant, for one move only
+    enPassantSquare = (moveType == Move::MoveType::MovedTwice) ? (fromSquare + toSquare) / 2 : -1;
+
+    // Castling rights are lost once the king moves, or once a rook leaves (or is captured on) its corner
+    castlingRights &= castlingRightsMask[fromSquare] & castlingRightsMask[toSquare];
+
+    hashKey ^= castlingKey() ^ enPassantKey();
+
+    // The fifty move rule counts from the last capture or pawn move
+    if (state.capturedPieceType != -1 || pieceType == playerPieceType) {
+        halfmoveClock = 0;
+    } else {
+        halfmoveClock++;
     }
+    if (Us == BLACK) {
+        fullmoveNumber++;
+    }
+
+    checkHashKey();
+}
 
+void Board::undoMove(const Move& move, const StateInfo& state) {
+    if (pieceOnSquare[move.getToSquare()] < 6) {
+        undoMoveFor<WHITE>(move, state);
+    } else {
+        undoMoveFor<BLACK>(move, state);
+    }
 }
 
-void Board::undoMove(const Move& move) {
+template<Color Us>
+void Board::undoMoveFor(const Move& move, const StateInfo& state) {
 
     int fromSquare = move.getFromSquare();
     int toSquare = move.getToSquare();
-    int pieceType = move.getPieceType();
+    int pieceType = pieceTypeAtSquare(toSquare);
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
     Move::MoveType moveType = move.getMoveType();
 
     switch(moveType) {
@@ -370,46 +664,44 @@ void Board::undoMove(const Move& move) {
             
         case Move::MoveType::Capture:
             movePiece(pieceType, toSquare, fromSquare);
-            addPiece(move.getCapturedPieceType(), toSquare);
+            addPiece(state.capturedPieceType, toSquare);
             break;
             
         case Move::MoveType::EnPassantCapture:
             movePiece(pieceType, toSquare, fromSquare);
-            if(pieceType == 0) { // checks whether the piece is white pawn
-                addPiece(6, move.getEnPassantSquare() + 8);
+            if(Us == WHITE) { // white pawn takes en passant
+                addPiece(6, toSquare + 8);
             } else {
-                addPiece(0, move.getEnPassantSquare() - 8);
+                addPiece(0, toSquare - 8);
             }
             break;
             
         case Move::MoveType::Promote:
-            removePiece(move.getPromotedPieceType(), toSquare);
-            addPiece(pieceType, fromSquare);
+            removePiece(pieceType, toSquare);
+            addPiece(playerPieceType, fromSquare);
             break;
             
 
         case Move::MoveType::PromoteCapture:
-            addPiece(pieceType, fromSquare);
-            removePiece(move.getPromotedPieceType(), toSquare);
-            addPiece(move.getCapturedPieceType(), toSquare);
+            removePiece(pieceType, toSquare);
+            addPiece(playerPieceType, fromSquare);
+            addPiece(state.capturedPieceType, toSquare);
             break;
             
         case Move::MoveType::CastleKingSide:
-            if (pieceType == 5) { // checks whether the piece is white king
-                movePiece(5, toSquare, fromSquare); // move the white king
+            movePiece(pieceType, toSquare, fromSquare); // move the king
+            if (Us == WHITE) { // white king castles
                 movePiece(3, 61, 63); // move the white rook
             } else {
-                movePiece(11, toSquare, fromSquare); // move the black king
                 movePiece(9, 5, 7); // move the black rook
             }
             break;
             
         case Move::MoveType::CastleQueenSide:
-            if (pieceType == 5) { // checks whether the piece is white king
-                movePiece(5, toSquare, fromSquare); // move the white king
+            movePiece(pieceType, toSquare, fromSquare); // move the king
+            if (Us == WHITE) { // white king castles
                 movePiece(3, 59, 56); // move the white rook
             } else {
-                movePiece(11, toSquare, fromSquare); // move the black king
                 movePiece(9, 3, 0); // move the black rook
             }
             break;
@@ -417,24 +709,64 @@ void Board::undoMove(const Move& move) {
         default:
             throw std::invalid_argument("Unknown MoveType");
     }
-        // whiteToMove = !whiteToMove;
-        // Full move clocks etc Todo
-        whiteKingSideCastling = move.getWhiteKingSideCastling();
-        whiteQueenSideCastling = move.getWhiteQueenSideCastling();
-        blackKingSideCastling = move.getBlackKingSideCastling();
-        blackQueenSideCastling = move.getBlackQueenSideCastling();
-        enPassantSquare = move.getEnPassantSquare();
-        //halfmoveClock = move.getHalfmoveClock();
-        //fullmoveNumber = move.getFullmoveNumber();
 
+    // Everything else is just popped back. The piece helpers above also updated hashKey, the saved key replaces that
+    castlingRights = state.castlingRights;
+    enPassantSquare = state.enPassantSquare;
+    halfmoveClock = state.halfmoveClock;
+    hashKey = state.hashKey;
+    st = state.previous; // with the parent's analysis, still up to date
+    if (Us == BLACK) {
+        fullmoveNumber--;
+    }
+    checkHashKey();
 }
 
 void Board::flipColour() {
     whiteToMove = !whiteToMove;
+    if (st) {
+        st->positionInfo.valid = false;
+        st->checkInfo.valid = false;
+    }
+    hashKey ^= zobristBlackToMove;
+}
+
+uint64_t Board::castlingKey() const {
+    return zobristCastling[castlingRights];
+}
+
+uint64_t Board::enPassantKey() const {
+    return enPassantSquare == -1 ? 0 : zobristEnPassantFile[enPassantSquare % 8];
+}
+
+uint64_t Board::computeHashKey() const {
+    uint64_t key = 0;
+    for (int pieceType = 0; pieceType < 12; ++pieceType) {
+        uint64_t pieces = bitboards[pieceType];
+        while (pieces) {
+            key ^= zobristPieceSquare[pieceType][__builtin_ctzll(pieces)];
+            pieces &= pieces - 1;
+        }
+    }
+    key ^= castlingKey() ^ enPassantKey();
+    if (!whiteToMove) {
+        key ^= zobristBlackToMove;
+    }
+    return key;
+}
+
+// Recomputing the key is far too slow for every move of a search, so this is compiled out unless asked for:
+// g++ -std=c++11 -pthread -DBOARD_DEBUG -o chessengine.out main.cpp board.cpp move.cpp movepicker.cpp evaluation.cpp perft.cpp
+void Board::checkHashKey() const {
+#ifdef BOARD_DEBUG
+    if (hashKey != computeHashKey()) {
+        throw std::logic_error("Zobrist key out of sync with the board");
+    }
+#endif
 }
 
 int Board::isGameOver() {
-    if(legalMoveGeneration().empty()) {
+    if(!hasAnyLegalMove()) {
         if(isKingInCheck()) {
             return whiteToMove ? -1 : 1;
         } else {
@@ -445,95 +777,105 @@ int Board::isGameOver() {
 }
 
 bool Board::isKingInCheck() {
-    int kingSquare;
-    uint64_t enemyPawns, enemyKnights, enemyBishopsQueens, enemyRooksQueens, enemyKing;
+    // Free if the moves of this position have been generated, otherwise cheaper than the whole analysis
+    if (st && st->positionInfo.valid) {
+        return st->positionInfo.checkers != 0;
+    }
+    if (sliderBackend == PEXT) {
+        return whiteToMove ? isKingInCheckFor<WHITE, PEXT>() : isKingInCheckFor<BLACK, PEXT>();
+    }
+    return whiteToMove ? isKingInCheckFor<WHITE, MAGIC>() : isKingInCheckFor<BLACK, MAGIC>();
+}
 
-    // Find the king's square and set up the enemy pieces' bitboards
-    if (!whiteToMove) {
-        kingSquare = __builtin_ctzll(bitboards[11]); // Black king
-        enemyPawns = bitboards[0];                   // White pawns
-        enemyKnights = bitboards[1];                 // White knights
-        enemyBishopsQueens = bitboards[2] | bitboards[4];   // White bishops and queens
-        enemyRooksQueens = bitboards[3] | bitboards[4];     // White rooks and queens
-        enemyKing = bitboards[5];                    // White king
-    } else {
-        kingSquare = __builtin_ctzll(bitboards[5]);  // White king
-        enemyPawns = bitboards[6];                   // Black pawns
-        enemyKnights = bitboards[7];                 // Black knights
-        enemyBishopsQueens = bitboards[8] | bitboards[10];  // Black bishops and queens
-        enemyRooksQueens = bitboards[9] | bitboards[10];    // Black rooks and queens
-        enemyKing = bitboards[11];                   // Black king
-    }
-
-    // Calculate the blocker bitboard (all pieces)
-    uint64_t blockers = 0;
-    for (int i = 0; i < 12; ++i) {
-        blockers |= bitboards[i];
-    }
-
-    // Print debug information
-    // std::cout << "King Square: " << kingSquare << std::endl;
-    // std::cout << "Blockers:" << std::endl;
-    // printBitboard(blockers);
-    // std::cout << "Enemy Pawns:" << std::endl;
-    // printBitboard(enemyPawns);
-    // std::cout << "Enemy Knights:" << std::endl;
-    // printBitboard(enemyKnights);
-    // std::cout << "Enemy Bishops/Queens:" << std::endl;
-    // printBitboard(enemyBishopsQueens);
-    // std::cout << "Enemy Rooks/Queens:" << std::endl;
-    // printBitboard(enemyRooksQueens);
-    // std::cout << "Enemy King:" << std::endl;
-    // printBitboard(enemyKing);
-
-        //uint64_t currentPawnCaptureMoves = isWhiteTurn ? 
-        //    (((1ULL << (fromSquare - 9)) & opponentPieces & ~FILE_A) | ((1ULL << (fromSquare - 7)) & opponentPieces & ~FILE_H)) :
-        //    (((1ULL << (fromSquare + 9)) & opponentPieces & ~FILE_H) | ((1ULL << (fromSquare + 7)) & opponentPieces & ~FILE_A));
-
-
-
-
-    // Check for pawn attacks on the king
-    uint64_t pawnAttacks = whiteToMove ? (((enemyPawns << 9) & ~FILE_A) | ((enemyPawns << 7) & ~FILE_H))
-                                    : (((enemyPawns >> 9) & ~FILE_A) | ((enemyPawns >> 7) & ~FILE_H));
-    if (pawnAttacks & (1ULL << kingSquare)) {
-        //std::cout << "King is in check by pawn attack" << std::endl;
-        return true;
+const Board::PositionInfo& Board::positionInfo(PositionInfo& scratch) {
+    PositionInfo& info = st ? st->positionInfo : scratch;
+    if (!st || !info.valid) {
+        if (sliderBackend == PEXT) {
+            whiteToMove ? analysePositionFor<WHITE, PEXT>(info) : analysePositionFor<BLACK, PEXT>(info);
+        } else {
+            whiteToMove ? analysePositionFor<WHITE, MAGIC>(info) : analysePositionFor<BLACK, MAGIC>(info);
+        }
     }
+    return info;
+}
 
-    // Check for knight attacks on the king
-    uint64_t knightAttacks = generateKnightAttacks(kingSquare);
-    if (enemyKnights & knightAttacks) {
-        //std::cout << "King is in check by knight attack" << std::endl;
-        return true;
+const Board::CheckInfo& Board::checkInfo(CheckInfo& scratch) {
+    CheckInfo& info = st ? st->checkInfo : scratch;
+    if (!st || !info.valid) {
+        if (sliderBackend == PEXT) {
+            whiteToMove ? analyseChecksFor<WHITE, PEXT>(info) : analyseChecksFor<BLACK, PEXT>(info);
+        } else {
+            whiteToMove ? analyseChecksFor<WHITE, MAGIC>(info) : analyseChecksFor<BLACK, MAGIC>(info);
+        }
     }
+    return info;
+}
 
-    // Check for diagonal attacks (bishops and queens) using blockers
-    if (generateBishopAttacks(kingSquare, blockers) & enemyBishopsQueens) {
-        //std::cout << "King is in check by bishop/queen diagonal attack" << std::endl;
-        return true;
+bool Board::givesCheck(const Move& move) {
+    if (sliderBackend == PEXT) {
+        return whiteToMove ? givesCheckFor<WHITE, PEXT>(move) : givesCheckFor<BLACK, PEXT>(move);
     }
+    return whiteToMove ? givesCheckFor<WHITE, MAGIC>(move) : givesCheckFor<BLACK, MAGIC>(move);
+}
+
+uint64_t Board::attackersTo(int square, uint64_t blockers) const {
+    return (sliderBackend == PEXT) ? attackersToFor<PEXT>(square, blockers) : attackersToFor<MAGIC>(square, blockers);
+}
+
+bool Board::isSquareAttacked(int square, Color byColour) const {
+    return (sliderBackend == PEXT) ? isSquareAttackedFor<PEXT>(square, byColour) : isSquareAttackedFor<MAGIC>(square, byColour);
+}
+
+template<Board::SliderBackend B>
+uint64_t Board::attackersToFor(int square, uint64_t blockers) const {
+    // A white pawn attacks the square from where a black pawn on it would attack, and the other way around
+    uint64_t bishopsQueens = bitboards[2] | bitboards[4] | bitboards[8] | bitboards[10];
+    uint64_t rooksQueens = bitboards[3] | bitboards[4] | bitboards[9] | bitboards[10];
+    return (getPawnAttacks(BLACK, square) & bitboards[0])
+         | (getPawnAttacks(WHITE, square) & bitboards[6])
+         | (getKnightAttacks(square) & (bitboards[1] | bitboards[7]))
+         | (getKingAttacks(square) & (bitboards[5] | bitboards[11]))
+         | (bishopAttacksFor<B>(square, blockers) & bishopsQueens)
+         | (rookAttacksFor<B>(square, blockers) & rooksQueens);
+}
+
+template<Board::SliderBackend B>
+bool Board::isSquareAttackedFor(int square, Color byColour) const {
+    const int enemyPieceType = (byColour == WHITE) ? 0 : 6;
 
-    // Check for horizontal and vertical attacks (rooks and queens) using blockers
-    if (generateRookAttacks(kingSquare, blockers) & enemyRooksQueens) {
-        //std::cout << "King is in check by rook/queen horizontal/vertical attack" << std::endl;
+    // Cheapest lookups first: the sliders need the magic tables
+    if (getPawnAttacks(byColour ^ 1, square) & bitboards[enemyPieceType]) {
         return true;
     }
-
-    // Check for king attacks (adjacent squares)
-    uint64_t kingAttacks = generateKingAttacks(kingSquare);
-    if (enemyKing & kingAttacks) {
-        //std::cout << "King is in check by enemy king" << std::endl;
+    if (getKnightAttacks(square) & bitboards[enemyPieceType + 1]) {
+        return true;
+    }
+    if (getKingAttacks(square) & bitboards[enemyPieceType + 5]) {
+        return true;
+    }
+    uint64_t queens = bitboards[enemyPieceType + 4];
+    if (bishopAttacksFor<B>(square, occupied) & (bitboards[enemyPieceType + 2] | queens)) {
         return true;
     }
+    return (rookAttacksFor<B>(square, occupied) & (bitboards[enemyPieceType + 3] | queens)) != 0;
+}
+
+template<Color Us, Board::SliderBackend B>
+bool Board::isKingInCheckFor() {
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;  // White pieces start at 0, Black pieces start at 6
+
+    // A position set up without a king has no square to look up in the magic tables
+    if (!bitboards[playerPieceType + 5]) {
+        return false;
+    }
 
-    return false;  // No attack found on the king
+    return isSquareAttackedFor<B>(__builtin_ctzll(bitboards[playerPieceType + 5]), (Us == WHITE) ? BLACK : WHITE);
 }
 
 
 
 
-uint64_t Board::generateKnightAttacks(int square) const {
+uint64_t Board::generateKnightAttacks(int square) {
     uint64_t knight = (1ULL << square);  // Start with the knight's current position
 
     // Masks to prevent knight moves from overflowing to the other side
@@ -564,7 +906,27 @@ uint64_t Board::generateKnightAttacks(int square) const {
     return attacks;
 }
 
-uint64_t Board::generateBishopAttacks(int square, uint64_t blockers) const {
+uint64_t Board::generateBishopAttacks(int square, uint64_t blockers) {
+    return (sliderBackend == PEXT) ? bishopAttacksFor<PEXT>(square, blockers) : bishopAttacksFor<MAGIC>(square, blockers);
+}
+
+uint64_t Board::generateRookAttacks(int square, uint64_t blockers) {
+    return (sliderBackend == PEXT) ? rookAttacksFor<PEXT>(square, blockers) : rookAttacksFor<MAGIC>(square, blockers);
+}
+
+template<Board::SliderBackend B>
+inline uint64_t Board::bishopAttacksFor(int square, uint64_t blockers) {
+    const SliderMagic& m = bishopMagics[square];
+    return m.attacks[sliderIndex<B>(m, blockers)];
+}
+
+template<Board::SliderBackend B>
+inline uint64_t Board::rookAttacksFor(int square, uint64_t blockers) {
+    const SliderMagic& m = rookMagics[square];
+    return m.attacks[sliderIndex<B>(m, blockers)];
+}
+
+uint64_t Board::slidingBishopAttacks(int square, uint64_t blockers) {
     uint64_t attacks = 0;
 
     // North-East diagonal (down-right, since the board is flipped)
@@ -594,7 +956,7 @@ uint64_t Board::generateBishopAttacks(int square, uint64_t blockers) const {
     return attacks;
 }
 
-uint64_t Board::generateRookAttacks(int square, uint64_t blockers) const {
+uint64_t Board::slidingRookAttacks(int square, uint64_t blockers) {
     uint64_t attacks = 0;
 
     // Generate attacks to the right (East direction)
@@ -624,7 +986,7 @@ uint64_t Board::generateRookAttacks(int square, uint64_t blockers) const {
     return attacks;
 }
 
-uint64_t Board::generateKingAttacks(int square) const {
+uint64_t Board::generateKingAttacks(int square) {
     uint64_t attacks = 0;
     uint64_t bitboard = 1ULL << square;
 
@@ -642,137 +1004,50 @@ uint64_t Board::generateKingAttacks(int square) const {
     return attacks;
 }
 
-// These are used only to generate x ray bitboards
-
-uint64_t Board::generateBishopXRay(int square, int kingSquare, uint64_t blockers) const {
-    uint64_t attacks = 0;
-    bool xRay = false;
-    int kingRank = kingSquare / 8;
-    int kingFile = kingSquare % 8;
-    int pieceRank = square / 8;
-    int pieceFile = square % 8;
-
-    // North-East diagonal (up-right)
-    if (kingRank > pieceRank && kingFile > pieceFile) {
-        for (int shift = square + 9; shift < 64 && (shift % 8 != 0); shift += 9) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // North-West diagonal (up-left)
-    if (kingRank > pieceRank && kingFile < pieceFile) {
-        for (int shift = square + 7; shift < 64 && (shift % 8 != 7); shift += 7) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // South-East diagonal (down-right)
-    if (kingRank < pieceRank && kingFile > pieceFile) {
-        for (int shift = square - 7; shift >= 0 && (shift % 8 != 0); shift -= 7) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // South-West diagonal (down-left)
-    if (kingRank < pieceRank && kingFile < pieceFile) {
-        for (int shift = square - 9; shift >= 0 && (shift % 8 != 7); shift -= 9) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // Only return attacks if the king was encountered on the x-ray path
-    return (attacks & (1ULL << kingSquare)) ? attacks : 0;
+// Precomputing Table getters
+uint64_t Board::getKnightAttacks(int square) const {
+    return knightAttacks[square];
 }
 
 
 
-
-
-
-uint64_t Board::generateRookXRay(int square, int kingSquare, uint64_t blockers) const {
-    uint64_t attacks = 0;
-    bool xRay = false;
-    int kingRank = kingSquare / 8;
-    int kingFile = kingSquare % 8;
-    int pieceRank = square / 8;
-    int pieceFile = square % 8;
-
-    // East (right) direction
-    if (kingRank == pieceRank && kingFile > pieceFile) {
-        for (int shift = square + 1; shift % 8 != 0 && shift < 64; shift++) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // West (left) direction
-    if (kingRank == pieceRank && kingFile < pieceFile) {
-        for (int shift = square - 1; shift % 8 != 7 && shift >= 0; shift--) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // North (up) direction
-    if (kingFile == pieceFile && kingRank < pieceRank) {
-        for (int shift = square - 8; shift >= 0; shift -= 8) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // South (down) direction
-    if (kingFile == pieceFile && kingRank > pieceRank) {
-        for (int shift = square + 8; shift < 64; shift += 8) {
-            attacks |= (1ULL << shift);
-            if (blockers & (1ULL << shift)) {
-                if (xRay || shift == kingSquare) break;
-                xRay = true;
-            }
-        }
-    }
-
-    // Only return attacks if the king was encountered on the x-ray path
-    return (attacks & (1ULL << kingSquare)) ? attacks : 0;
+std::vector<Move> Board::legalMoveGeneration() {
+    MoveList moves;
+    legalMoveGeneration(moves);
+    return std::vector<Move>(moves.begin(), moves.end());
 }
 
+void Board::legalMoveGeneration(MoveList& moves) {
+    generateMoves(moves, ALL);
+}
 
+void Board::generateCaptures(MoveList& moves) {
+    generateMoves(moves, CAPTURES);
+}
 
-// Precomputing Table getters
-uint64_t Board::getKnightAttacks(int square) {
-    return knightAttacks[square];
+void Board::generateQuiets(MoveList& moves) {
+    generateMoves(moves, QUIETS);
 }
 
+void Board::generateEvasions(MoveList& moves) {
+    generateMoves(moves, EVASIONS);
+}
 
+// CAPTURES gives the captures, en passant and queen promotions, QUIETS everything else (including castling and
+// under promotions), so a search can try the captures before it pays for the quiet moves.
+// ALL gives both, captures first for alpha beta pruning: the quiet moves are collected in a second list on the
+// stack and appended at the end. EVASIONS is ALL for a side in check, and nothing at all when not in check.
+// Every type shares the same king danger, check and pin analysis below
+void Board::generateMoves(MoveList& moves, GenType type) {
+    if (sliderBackend == PEXT) {
+        whiteToMove ? generateMovesFor<WHITE, PEXT>(moves, type) : generateMovesFor<BLACK, PEXT>(moves, type);
+    } else {
+        whiteToMove ? generateMovesFor<WHITE, MAGIC>(moves, type) : generateMovesFor<BLACK, MAGIC>(moves, type);
+    }
+}
 
-std::vector<Move> Board::legalMoveGeneration() {
-    
-    vector<Move> legalMoves;
+template<Color Us, Board::SliderBackend B>
+void Board::analysePositionFor(PositionInfo& info) {
 
     // https://peterellisjones.com/posts/generating-legal-chess-moves-efficiently/
     // ******************************************************************************
@@ -781,838 +1056,797 @@ std::vector<Move> Board::legalMoveGeneration() {
     // ******************************************************************************
 
     uint64_t kingDangerSquares = 0;
-    uint64_t pawns, knights, bishopQueens, rookQueens, king;
-    uint64_t enemyPawns, enemyKnights, enemyBishopsQueens, enemyRooksQueens, enemyKing;
-    int kingIndex;
     int kingSquare;
-    int kingAttacks = 0; // for double check or single check
-    int kingAttackedAtSquare = -1; // which square is checking the king
-    int checkingPieceType = -1; // which piece type is checking the king
-    int playerPieceType = whiteToMove ? 0 : 6;  // White pieces start at 0, Black pieces start at 6
-    int opponentPieceType = whiteToMove ? 6 : 0;
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;  // White pieces start at 0, Black pieces start at 6
+    const int enemyPieceType = (Us == WHITE) ? 6 : 0;
+    const int colour = Us;
 
+    uint64_t king = bitboards[playerPieceType + 5];
+    uint64_t enemyPawns = bitboards[enemyPieceType];
+    uint64_t enemyKnights = bitboards[enemyPieceType + 1];
+    uint64_t enemyBishopsQueens = bitboards[enemyPieceType + 2] | bitboards[enemyPieceType + 4];
+    uint64_t enemyRooksQueens = bitboards[enemyPieceType + 3] | bitboards[enemyPieceType + 4];
+    uint64_t enemyKing = bitboards[enemyPieceType + 5];
 
-    if (!whiteToMove) {
-        enemyPawns = bitboards[0];                   // White pawns
-        enemyKnights = bitboards[1];                 // White knights
-        enemyBishopsQueens = bitboards[2] | bitboards[4];   // White bishops and queens
-        enemyRooksQueens = bitboards[3] | bitboards[4];     // White rooks and queens
-        enemyKing = bitboards[5];                    // White king
-        pawns = bitboards[6];                        // Black pawns
-        knights = bitboards[7];                      // Black knights
-        bishopQueens = bitboards[8] | bitboards[10];
-        rookQueens = bitboards[9] | bitboards[10];
-        king = bitboards[11];
-        kingIndex = 11;
-        kingSquare = __builtin_ctzll(bitboards[11]);
-    } else {
-        enemyPawns = bitboards[6];                   // Black pawns
-        enemyKnights = bitboards[7];                 // Black knights
-        enemyBishopsQueens = bitboards[8] | bitboards[10];  // Black bishops and queens
-        enemyRooksQueens = bitboards[9] | bitboards[10];    // Black rooks and queens
-        enemyKing = bitboards[11];                   // Black king
-        pawns = bitboards[0];                        // White pawns
-        knights = bitboards[1];                      // White knights
-        bishopQueens = bitboards[2] | bitboards[4];
-        rookQueens = bitboards[3] | bitboards[4];
-        king = bitboards[5];
-        kingIndex = 5;
-        kingSquare = __builtin_ctzll(bitboards[5]);
-    }
+    info.valid = true;
 
-    // Calculate the blocker bitboard except for current king
-    uint64_t blockers = 0; 
-    for (int i = 0; i < 12; ++i) {
-        if(i == kingIndex) continue;
-        blockers |= bitboards[i];
+    // Same as isKingInCheck(): a position set up without a king has no squares to look up
+    if (!king || !enemyKing) {
+        info.kingSquare = -1;
+        info.checkers = info.pinned = info.kingDanger = 0;
+        info.checkMask = ~0ULL;
+        return;
     }
+    kingSquare = __builtin_ctzll(king);
 
+    uint64_t playerPieces = occupancy[colour];
+    uint64_t opponentPieces = occupancy[colour ^ 1];
 
-    if (!whiteToMove) {
-        // Checking pawn attacks
-        if ((enemyPawns >> 9) & (1ULL << kingSquare) & ~FILE_A) {kingAttacks++; kingAttackedAtSquare = kingSquare + 9; checkingPieceType = 0;}
-        if ((enemyPawns >> 7) & (1ULL << kingSquare) & ~FILE_H) {kingAttacks++; kingAttackedAtSquare = kingSquare + 7; checkingPieceType = 0;}
+    // Calculate the blocker bitboard except for current king
+    uint64_t blockers = occupied & ~king;
 
+    if (Us == BLACK) {
         kingDangerSquares |= ((enemyPawns >> 9) & ~FILE_A);  // Pawns attacking from the left
         kingDangerSquares |= ((enemyPawns >> 7) & ~FILE_H);  // Pawns attacking from the right
-
     } else {
-        if ((enemyPawns << 9) & (1ULL << kingSquare) & ~FILE_H) {kingAttacks++; kingAttackedAtSquare = kingSquare - 9; checkingPieceType = 6;}
-        if ((enemyPawns << 7) & (1ULL << kingSquare) & ~FILE_A) {kingAttacks++; kingAttackedAtSquare = kingSquare - 7; checkingPieceType = 6;}
         kingDangerSquares |= ((enemyPawns << 9) & ~FILE_H);
         kingDangerSquares |= ((enemyPawns << 7) & ~FILE_A);
     }
 
-    // Checking knight attacks
-    uint64_t knightAttacks = 0;
     uint64_t enemyKnightsCopy = enemyKnights;
     while (enemyKnightsCopy) {
-        int square = __builtin_ctzll(enemyKnightsCopy);
-        knightAttacks |= generateKnightAttacks(square);
-        kingDangerSquares |= generateKnightAttacks(square);
-
-        if(knightAttacks & (1ULL << kingSquare)) {
-            kingAttacks++; 
-            kingAttackedAtSquare = square;
-            checkingPieceType = whiteToMove? 7 : 1;
-        }
-
+        kingDangerSquares |= getKnightAttacks(__builtin_ctzll(enemyKnightsCopy));
         enemyKnightsCopy &= enemyKnightsCopy - 1;
     }
 
-    // Checking bishop/queen (diagonal) attacks
-    uint64_t bishopAttacks = 0;
     uint64_t enemyBishopsQueensCopy = enemyBishopsQueens;
     while (enemyBishopsQueensCopy) {
-        int square = __builtin_ctzll(enemyBishopsQueensCopy);
-        bishopAttacks |= generateBishopAttacks(square, blockers);
-        if (bishopAttacks & (1ULL << kingSquare)) {
-            kingAttacks++;
-            kingAttackedAtSquare = square;
-            checkingPieceType = whiteToMove? 8 : 2;
-        }
-        kingDangerSquares |= generateBishopAttacks(square, blockers);
+        kingDangerSquares |= bishopAttacksFor<B>(__builtin_ctzll(enemyBishopsQueensCopy), blockers);
         enemyBishopsQueensCopy &= enemyBishopsQueensCopy - 1;
     }
 
-
-    // Checking rook/queen (horizontal/vertical) attacks
-    uint64_t rookAttacks = 0;
     uint64_t enemyRooksQueensCopy = enemyRooksQueens;
     while (enemyRooksQueensCopy) {
-        int square = __builtin_ctzll(enemyRooksQueensCopy);
-        rookAttacks |= generateRookAttacks(square, blockers);
-        if (rookAttacks & (1ULL << kingSquare)) {
-            kingAttacks++;
-            kingAttackedAtSquare = square;
-            checkingPieceType = whiteToMove? 9 : 3;
-        }
-        kingDangerSquares |= generateRookAttacks(square, blockers);
+        kingDangerSquares |= rookAttacksFor<B>(__builtin_ctzll(enemyRooksQueensCopy), blockers);
         enemyRooksQueensCopy &= enemyRooksQueensCopy - 1;
     }
 
+    kingDangerSquares |= getKingAttacks(__builtin_ctzll(enemyKing));
 
-    // Checking king attacks
-    kingDangerSquares |= generateKingAttacks(__builtin_ctzll(enemyKing));
-
-    //Check if there's a double check
-    // if (kingAttacks >= 2) {
-    //     std::cout << "Double check!\n";
-    // } else if (kingAttacks == 1) {
-    //     std::cout << "Single check!\n";
-    // } else {
-    //     std::cout << "King is not in check.\n";
-    // }
-    // std:: cout << "King Danger Squares\n";
-    // std::bitset<64> dangerSquares(kingDangerSquares);
-    // for (int i = 0; i < 64; i++) {
-    //     std::cout << dangerSquares[i];
-    //     if ((i + 1) % 8 == 0) {
-    //         std::cout << std::endl;
-    //     }
-    // }
-    // std::cout << "King Attacked At Square: " << kingAttackedAtSquare << std::endl;
-    // std:: cout << "Piece type attacking :" << checkingPieceType << std::endl;
-    // ******************************************************************************
-    // 2)   -> if in double check, you can only evade
-    //      -> if in single check, then evade, captures or block the check
-    //      -> en passant checks
-    // ******************************************************************************
-
-    if(kingAttacks > 0) {
-        // Evade the double check by only moving the king
-        // Also make sure that any captures are legal and on enemy pieces
-        uint64_t kingMoves = generateKingAttacks(kingSquare) & ~kingDangerSquares;
-        while (kingMoves) {
-            int toSquare = __builtin_ctzll(kingMoves);
-            if(pieceTypeAtSquare(toSquare) == -1) {
-                legalMoves.push_back(Move(kingSquare, toSquare, kingIndex, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                kingMoves &= kingMoves - 1;
-                continue;
-            } 
-            if(whiteToMove) {
-                // check that the piece is an enemy piece
-                if(pieceTypeAtSquare(toSquare) >= 6) {
-                    legalMoves.push_back(Move(kingSquare, toSquare, kingIndex, pieceTypeAtSquare(toSquare), -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-            } else {
-                if(pieceTypeAtSquare(toSquare) < 6) {
-                    legalMoves.push_back(Move(kingSquare, toSquare, kingIndex, pieceTypeAtSquare(toSquare), -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-            }   
-            kingMoves &= kingMoves - 1;
-        }
+    // Every enemy piece attacking our king, looked up from the king square
+    uint64_t checkers = attackersToFor<B>(kingSquare, occupied) & opponentPieces;
 
+    // In single check every other move has to capture the checking piece or block its ray.
+    // between[][] is empty for pawns and knights, so those can only be captured
+    uint64_t checkMask = ~0ULL;
+    if(popCount(checkers) == 1) {
+        checkMask = checkers | getBetween(kingSquare, __builtin_ctzll(checkers));
     }
 
-    if(kingAttacks == 2) return legalMoves; // No other moves can be made if in double check
-
-    if(kingAttacks == 1) {
-        // ******************************************************************************
-        // Capture the attacking piece with other pieces
-        // Find all captures that can be made at square kingAttackedAtSquare
-        // ******************************************************************************
-
-
-
-        // FOLLOWING CODE IS FOR EDGE CASE --> A PIECE CAN BLOCK THE CHECK BUT IS PINNED BY ANOTHER PIECE
-        // SO the x ray bitboard from below has to be copied
-        uint64_t xrayBitboard = 0ULL; // get attack rays from all sliding pieces - will ignore one friendly piece
-            blockers |= king; // add the king to the blockers so that we can get the xray bitboard  
-            // Checking bishop/queen (diagonal) attacks
-            enemyBishopsQueensCopy = enemyBishopsQueens;
-            while (enemyBishopsQueensCopy) {
-                int square = __builtin_ctzll(enemyBishopsQueensCopy);
-                xrayBitboard |= generateBishopXRay(square, kingSquare, blockers);
-                enemyBishopsQueensCopy &= enemyBishopsQueensCopy - 1;
-            }
-
-            // Checking rook/queen (horizontal/vertical) attacks
-            rookAttacks = 0;
-            enemyRooksQueensCopy = enemyRooksQueens;
-            while (enemyRooksQueensCopy) {
-                int square = __builtin_ctzll(enemyRooksQueensCopy);
-                xrayBitboard |= generateRookXRay(square, kingSquare, blockers);
-                enemyRooksQueensCopy &= enemyRooksQueensCopy - 1;
-            }
-
-
+    // ******************************************************************************
+    // 2) -> pinned pieces
+    /*
+        Look from our king through the enemy pieces only: any enemy slider that can see the king this way
+        is a possible pinner. If exactly one piece stands between them and it is ours, it is pinned.
 
+        A pinned piece can still move along the line through the king and the pinner, so its targets are
+        limited to line[king][piece]. Knights can never stay on that line, so a pinned knight never moves.
+    */
+    // ******************************************************************************
 
-        // Pawns
-        uint64_t leftPawnCaptures = (whiteToMove) ? ((pawns >> 9) & ~FILE_A) : ((pawns << 7) & ~FILE_H);
-        uint64_t rightPawnCaptures = (whiteToMove) ? ((pawns >> 7) & ~FILE_H) : ((pawns << 9) & ~FILE_A);
-        int pieceType = whiteToMove? 0 : 6;
-        bool isPromotingRank = (whiteToMove && kingAttackedAtSquare / 8 == 0) || (!whiteToMove && kingAttackedAtSquare / 8 == 7);
+    uint64_t pinned = 0ULL;
+    uint64_t pinners = (bishopAttacksFor<B>(kingSquare, opponentPieces) & enemyBishopsQueens)
+                     | (rookAttacksFor<B>(kingSquare, opponentPieces) & enemyRooksQueens);
+    while (pinners) {
+        uint64_t between = getBetween(kingSquare, __builtin_ctzll(pinners)) & occupied;
+        if (between && !(between & (between - 1)) && (between & playerPieces)) {
+            pinned |= between;
+        }
+        pinners &= pinners - 1;
+    }
 
-        if (leftPawnCaptures & (1ULL << kingAttackedAtSquare) && !(xrayBitboard & (1ULL << kingAttackedAtSquare))) {
+    info.kingSquare = kingSquare;
+    info.checkers = checkers;
+    info.checkMask = checkMask;
+    info.pinned = pinned;
+    info.kingDanger = kingDangerSquares;
+}
 
-            int fromSquare = whiteToMove ? kingAttackedAtSquare + 9 : kingAttackedAtSquare - 7;
+template<Color Us, Board::SliderBackend B>
+void Board::analyseChecksFor(CheckInfo& info) {
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
+    const int enemyPieceType = (Us == WHITE) ? 6 : 0;
+    uint64_t enemyKing = bitboards[enemyPieceType + 5];
+
+    info.valid = true;
+    if (!enemyKing) {
+        info.enemyKingSquare = -1;
+        for (int i = 0; i < 6; i++) {
+            info.checkSquares[i] = 0;
+        }
+        info.discoveredCheckers = 0;
+        return;
+    }
+    int kingSquare = __builtin_ctzll(enemyKing);
+
+    // Attacks are symmetric: a piece on a square attacks the king if the same piece on the king's square would
+    // attack that square. Pawns are the exception, which is why the enemy's pawn table is used
+    uint64_t bishopSquares = bishopAttacksFor<B>(kingSquare, occupied);
+    uint64_t rookSquares = rookAttacksFor<B>(kingSquare, occupied);
+    info.enemyKingSquare = kingSquare;
+    info.checkSquares[0] = getPawnAttacks(Us ^ 1, kingSquare);
+    info.checkSquares[1] = getKnightAttacks(kingSquare);
+    info.checkSquares[2] = bishopSquares;
+    info.checkSquares[3] = rookSquares;
+    info.checkSquares[4] = bishopSquares | rookSquares;
+    info.checkSquares[5] = 0; // a king can never give check
+
+    // The pin search of analysePositionFor() turned around: from the enemy king through our pieces to our sliders.
+    // If one of our pieces is all that stands between, moving it off the line uncovers a check
+    uint64_t ourBishopsQueens = bitboards[playerPieceType + 2] | bitboards[playerPieceType + 4];
+    uint64_t ourRooksQueens = bitboards[playerPieceType + 3] | bitboards[playerPieceType + 4];
+    uint64_t enemyPieces = occupancy[Us ^ 1];
+    uint64_t discoveredCheckers = 0;
+    uint64_t snipers = (bishopAttacksFor<B>(kingSquare, enemyPieces) & ourBishopsQueens)
+                     | (rookAttacksFor<B>(kingSquare, enemyPieces) & ourRooksQueens);
+    while (snipers) {
+        uint64_t between = getBetween(kingSquare, __builtin_ctzll(snipers)) & occupied;
+        if (between && !(between & (between - 1))) {
+            discoveredCheckers |= between; // ours, an enemy piece would have stopped the ray
+        }
+        snipers &= snipers - 1;
+    }
+    info.discoveredCheckers = discoveredCheckers;
+}
 
-            if(isPromotingRank) {
-                int knightIndex;
-                if(kingIndex == 5) {
-                    knightIndex = 1;
-                } else {
-                    knightIndex = 7;
-                }
-                //std::cout << "LeftPawn promotion capture at  " << fromSquare << " to " << kingAttackedAtSquare << std::endl;
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex+1, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex+2, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex+3, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            } else {               
-                //std::cout << "Left Pawn capture at  " << fromSquare << " to " << kingAttackedAtSquare << std::endl;
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
+template<Color Us, Board::SliderBackend B>
+bool Board::givesCheckFor(const Move& move) {
+    CheckInfo scratch;
+    const CheckInfo& info = checkInfo(scratch);
+    if (info.enemyKingSquare < 0) {
+        return false;
+    }
 
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
+    int fromSquare = move.getFromSquare();
+    int toSquare = move.getToSquare();
+    int kingSquare = info.enemyKingSquare;
+    Move::MoveType moveType = move.getMoveType();
 
-        if (rightPawnCaptures & (1ULL << kingAttackedAtSquare) && !(xrayBitboard & (1ULL << kingAttackedAtSquare))) {
+    // Direct check: the moved piece lands on one of its check squares. A promoting pawn becomes another piece,
+    // which is handled below
+    if (!move.isPromotion() && (info.checkSquares[pieceTypeAtSquare(fromSquare) - playerPieceType] & (1ULL << toSquare))) {
+        return true;
+    }
 
-            int fromSquare = whiteToMove ? kingAttackedAtSquare + 7 : kingAttackedAtSquare - 9;
+    // Discovered check: a piece on the line from our slider to the king leaves the line
+    if ((info.discoveredCheckers & (1ULL << fromSquare)) && !(getLine(kingSquare, fromSquare) & (1ULL << toSquare))) {
+        return true;
+    }
 
-            if(isPromotingRank) {
-                int knightIndex;
-                if(kingIndex == 5) {
-                    knightIndex = 1;
-                } else {
-                    knightIndex = 7;
-                }
-                //std::cout << "Right Pawn promotion capture at  " << fromSquare << " to " << kingAttackedAtSquare << std::endl;
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex+1, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex+2, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, knightIndex+3, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            } else {               
-                //std::cout << "Right Pawn capture at  " << fromSquare << " to " << kingAttackedAtSquare << std::endl;
-                legalMoves.push_back(Move(fromSquare, kingAttackedAtSquare, pieceType, checkingPieceType, -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
+    uint64_t kingBit = 1ULL << kingSquare;
+    switch (moveType) {
+        case Move::MoveType::Promote:
+        case Move::MoveType::PromoteCapture: {
+            // The check squares were found with the pawn still on its square, which can block the new piece's line
+            uint64_t blockers = occupied ^ (1ULL << fromSquare);
+            int promotedPiece = move.getPromotedPiece();
+            if (promotedPiece == 1) {
+                return getKnightAttacks(toSquare) & kingBit;
             }
-        }
-
-        // Knights
-        uint64_t knightCopy = knights; // create the copy so we can reuse it later
-        while (knightCopy) {
-            int square = __builtin_ctzll(knightCopy);
-
-            if(((xrayBitboard & (1ULL << square)))) {
-                knightCopy &= knightCopy - 1;
-                continue; // if the knight is pinned, we can't move it
+            uint64_t attacks = 0;
+            if (promotedPiece == 2 || promotedPiece == 4) {
+                attacks |= bishopAttacksFor<B>(toSquare, blockers);
             }
-            
-            uint64_t knightMoves = generateKnightAttacks(square);
-            if (knightMoves & (1ULL << kingAttackedAtSquare)) {
-                //std::cout << "Knight capture at  " << square << " to " << kingAttackedAtSquare << std::endl;
-                pieceType = whiteToMove ? 1 : 7;
-                legalMoves.push_back(Move(square, kingAttackedAtSquare, pieceType, checkingPieceType, -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
+            if (promotedPiece == 3 || promotedPiece == 4) {
+                attacks |= rookAttacksFor<B>(toSquare, blockers);
             }
-            knightCopy &= knightCopy - 1;
+            return attacks & kingBit;
         }
 
-        // Bishops/Queens
-        uint64_t bishopQueensCopy = bishopQueens; // create the copy so we can reuse it later
-        while (bishopQueensCopy) {
-            int square = __builtin_ctzll(bishopQueensCopy);
-
-            if(((xrayBitboard & (1ULL << square)))) {
-                bishopQueensCopy &= bishopQueensCopy - 1;
-                continue; // if the bishop is pinned we can't move it
-            }
-
-            uint64_t bishopMoves = generateBishopAttacks(square, blockers);
-            if (bishopMoves & (1ULL << kingAttackedAtSquare)) {
-                //std::cout << "Bishop capture at  " << square << " to " << kingAttackedAtSquare << std::endl;
-                pieceType = pieceTypeAtSquare(square);
-                legalMoves.push_back(Move(square, kingAttackedAtSquare, pieceType, checkingPieceType, -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            bishopQueensCopy &= bishopQueensCopy - 1;
+        case Move::MoveType::EnPassantCapture: {
+            // Two pawns leave the board at once, so look for a discovered slider check on the board after the move
+            int capturedSquare = (Us == WHITE) ? toSquare + 8 : toSquare - 8;
+            uint64_t blockers = (occupied ^ (1ULL << fromSquare) ^ (1ULL << capturedSquare)) | (1ULL << toSquare);
+            uint64_t bishopsQueens = bitboards[playerPieceType + 2] | bitboards[playerPieceType + 4];
+            uint64_t rooksQueens = bitboards[playerPieceType + 3] | bitboards[playerPieceType + 4];
+            return (bishopAttacksFor<B>(kingSquare, blockers) & bishopsQueens)
+                 | (rookAttacksFor<B>(kingSquare, blockers) & rooksQueens);
         }
 
-
-        // Rooks/Queens
-        uint64_t rookQueensCopy = rookQueens; // create the copy so we can reuse it later
-        while (rookQueensCopy) {
-            int square = __builtin_ctzll(rookQueensCopy);
-
-            if((xrayBitboard & (1ULL << square))) {
-                rookQueensCopy &= rookQueensCopy - 1;
-                continue; // if the rook is pinned we can't move it
-            }
-            uint64_t rookMoves = generateRookAttacks(square, blockers);
-            if (rookMoves & (1ULL << kingAttackedAtSquare)) {
-                //std::cout << "Rook capture at  " << square << " to " << kingAttackedAtSquare << std::endl;
-                pieceType = pieceTypeAtSquare(square);
-                legalMoves.push_back(Move(square, kingAttackedAtSquare, pieceType, checkingPieceType, -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            rookQueensCopy &= rookQueensCopy - 1;
+        case Move::MoveType::CastleKingSide:
+        case Move::MoveType::CastleQueenSide: {
+            // Only the rook can give check, from its square next to the king
+            bool kingSide = moveType == Move::MoveType::CastleKingSide;
+            int rookFrom = (Us == WHITE) ? (kingSide ? 63 : 56) : (kingSide ? 7 : 0);
+            int rookTo = (Us == WHITE) ? (kingSide ? 61 : 59) : (kingSide ? 5 : 3);
+            uint64_t blockers = (occupied ^ (1ULL << fromSquare) ^ (1ULL << rookFrom)) | (1ULL << toSquare) | (1ULL << rookTo);
+            return rookAttacksFor<B>(rookTo, blockers) & kingBit;
         }
-        
 
-        // ******************************************************************************
-        // Block the sliding piece
-        // find the bitboard of the sliding piece that is attacking our king so that we can find moves that block it from kingAttackedAtSquare
-        // ******************************************************************************
-        if(checkingPieceType == 0 || checkingPieceType == 6 || checkingPieceType == 1 || checkingPieceType == 7) {
-            return legalMoves; // You can't block a pawn or a knight attacks
+        default:
+            return false;
+    }
+}
+
+// Adds the four promotions of one pawn move: the queen with the captures, the under promotions with the quiet moves
+static void addPromotions(int fromSquare, int toSquare, Move::MoveType moveType, Board::GenType type, MoveList& captures, MoveList& quiets) {
+    if (type != Board::QUIETS) {
+        captures.push_back(Move(fromSquare, toSquare, moveType, 4));
+    }
+    if (type != Board::CAPTURES) {
+        for (int promotedPiece = 1; promotedPiece <= 3; ++promotedPiece) {
+            quiets.push_back(Move(fromSquare, toSquare, moveType, promotedPiece));
         }
+    }
+}
 
-        uint64_t blockingMask = 0ULL;
-        int kingRank = kingSquare / 8;
-        int kingFile = kingSquare % 8;
-        int pieceRank = kingAttackedAtSquare / 8;
-        int pieceFile = kingAttackedAtSquare % 8;
+// Every push, double push and capture in one direction is a single shift of the whole set of pawns
+template<Color Us>
+Board::PawnTargets Board::pawnTargets(uint64_t pawns, uint64_t targetMask) const {
+    // White pawns move towards row 0 (rank 8), black pawns towards row 7 (rank 1)
+    const uint64_t doublePushRank = (Us == WHITE) ? 0x0000FF0000000000ULL : 0x0000000000FF0000ULL; // where a pawn on its start row lands after one push
+
+    uint64_t empty = ~occupied;
+    uint64_t enemies = occupancy[Us ^ 1] & targetMask;
+
+    PawnTargets t;
+    t.promotionRank = (Us == WHITE) ? 0x00000000000000FFULL : 0xFF00000000000000ULL;
+    // FILE_A / FILE_H are flipped (FILE_A is the h-file): they stop a capture wrapping round to the other side of the board
+    uint64_t singlePushes = ((Us == WHITE) ? pawns >> 8 : pawns << 8) & empty;
+    t.doublePushes = ((Us == WHITE) ? (singlePushes & doublePushRank) >> 8 : (singlePushes & doublePushRank) << 8) & empty & targetMask;
+    t.singlePushes = singlePushes & targetMask;
+    t.westCaptures = ((Us == WHITE) ? (pawns >> 9) : (pawns << 7)) & ~FILE_A & enemies;
+    t.eastCaptures = ((Us == WHITE) ? (pawns >> 7) : (pawns << 9)) & ~FILE_H & enemies;
+    return t;
+}
 
-        // Directional deltas for rooks and bishops (used for queens as well)
-        int rankDelta = pieceRank - kingRank;
-        int fileDelta = pieceFile - kingFile;
+// The moves of a whole set of pawns at once: the moves come out by bit scanning the destination squares of
+// pawnTargets(). The from square is the destination minus the shift. En passant is left to the callers
+template<Color Us>
+void Board::generatePawnMoves(uint64_t pawns, uint64_t targetMask, GenType type, MoveList& captures, MoveList& quiets) const {
+    const int up = (Us == WHITE) ? -8 : 8;
+    const int west = (Us == WHITE) ? -9 : 7;  // capture towards the a-file
+    const int east = (Us == WHITE) ? -7 : 9;  // capture towards the h-file
+
+    PawnTargets t = pawnTargets<Us>(pawns, targetMask);
+    const uint64_t promotionRank = t.promotionRank;
+    uint64_t singlePushes = t.singlePushes;
+    uint64_t doublePushes = t.doublePushes;
+    uint64_t westCaptures = t.westCaptures;
+    uint64_t eastCaptures = t.eastCaptures;
+
+    if (type != QUIETS) {
+        uint64_t targets = westCaptures & ~promotionRank;
+        while (targets) {
+            int toSquare = __builtin_ctzll(targets);
+            captures.push_back(Move(toSquare - west, toSquare, Move::MoveType::Capture));
+            targets &= targets - 1;
+        }
+        targets = eastCaptures & ~promotionRank;
+        while (targets) {
+            int toSquare = __builtin_ctzll(targets);
+            captures.push_back(Move(toSquare - east, toSquare, Move::MoveType::Capture));
+            targets &= targets - 1;
+        }
+    }
+
+    // Promotions, only a pawn one step from the last row can get there
+    if ((singlePushes | westCaptures | eastCaptures) & promotionRank) {
+        uint64_t targets = singlePushes & promotionRank;
+        while (targets) {
+            int toSquare = __builtin_ctzll(targets);
+            addPromotions(toSquare - up, toSquare, Move::MoveType::Promote, type, captures, quiets);
+            targets &= targets - 1;
+        }
+        targets = westCaptures & promotionRank;
+        while (targets) {
+            int toSquare = __builtin_ctzll(targets);
+            addPromotions(toSquare - west, toSquare, Move::MoveType::PromoteCapture, type, captures, quiets);
+            targets &= targets - 1;
+        }
+        targets = eastCaptures & promotionRank;
+        while (targets) {
+            int toSquare = __builtin_ctzll(targets);
+            addPromotions(toSquare - east, toSquare, Move::MoveType::PromoteCapture, type, captures, quiets);
+            targets &= targets - 1;
+        }
+    }
+
+    if (type != CAPTURES) {
+        uint64_t targets = singlePushes & ~promotionRank;
+        while (targets) {
+            int toSquare = __builtin_ctzll(targets);
+            quiets.push_back(Move(toSquare - up, toSquare, Move::MoveType::Normal));
+            targets &= targets - 1;
+        }
+        while (doublePushes) {
+            int toSquare = __builtin_ctzll(doublePushes);
+            quiets.push_back(Move(toSquare - 2 * up, toSquare, Move::MoveType::MovedTwice));
+            doublePushes &= doublePushes - 1;
+        }
+    }
+}
 
+// Castling needs the right, the king and the rook on their start squares, an empty path between them, and no
+// attack on the squares the king crosses and lands on. Only asked when not in check, so the king's own square is
+// already safe. The b1 / b8 square only has to be empty for the rook to pass.
+// A FEN can keep a right after its king or rook has left, so the pieces are checked as well as the right
+bool Board::canCastle(int right, uint64_t kingDanger) const {
+    uint64_t path = 0;
+    uint64_t kingPath = 0;
+    bool piecesHome = false;
+    switch (right) {
+        case WHITE_KING_SIDE:
+            path = (1ULL << 61) | (1ULL << 62); kingPath = path;
+            piecesHome = (bitboards[5] & (1ULL << 60)) && (bitboards[3] & (1ULL << 63));
+            break;
+        case WHITE_QUEEN_SIDE:
+            path = (1ULL << 57) | (1ULL << 58) | (1ULL << 59); kingPath = (1ULL << 58) | (1ULL << 59);
+            piecesHome = (bitboards[5] & (1ULL << 60)) && (bitboards[3] & (1ULL << 56));
+            break;
+        case BLACK_KING_SIDE:
+            path = (1ULL << 5) | (1ULL << 6); kingPath = path;
+            piecesHome = (bitboards[11] & (1ULL << 4)) && (bitboards[9] & (1ULL << 7));
+            break;
+        case BLACK_QUEEN_SIDE:
+            path = (1ULL << 1) | (1ULL << 2) | (1ULL << 3); kingPath = (1ULL << 2) | (1ULL << 3);
+            piecesHome = (bitboards[11] & (1ULL << 4)) && (bitboards[9] & (1ULL << 0));
+            break;
+    }
+    return (castlingRights & right) && piecesHome && !(occupied & path) && !(kingDanger & kingPath);
+}
 
-        // finding the bitboard of the attacks of te sliding piece that is attacking our king        
+// Two pawns leave the board at once, so the pin and check masks can't tell if an en passant capture is legal.
+// Instead look from the king at the board as it would be after the capture: this catches the usual pins,
+// the pawn that stood between the king and a rook on the same rank, and the discovered checks.
+// A knight or pawn giving check stays there unless it is the pawn being captured
+template<Color Us, Board::SliderBackend B>
+bool Board::isEnPassantLegal(int fromSquare, const PositionInfo& info) const {
+    const int enemyPieceType = (Us == WHITE) ? 6 : 0;
+    uint64_t enemyBishopsQueens = bitboards[enemyPieceType + 2] | bitboards[enemyPieceType + 4];
+    uint64_t enemyRooksQueens = bitboards[enemyPieceType + 3] | bitboards[enemyPieceType + 4];
+    int capturedSquare = enPassantSquare + ((Us == WHITE) ? 8 : -8);
+
+    uint64_t occupiedAfter = (occupied ^ (1ULL << fromSquare) ^ (1ULL << capturedSquare)) | (1ULL << enPassantSquare);
+    return !(info.checkers & (bitboards[enemyPieceType] | bitboards[enemyPieceType + 1]) & ~(1ULL << capturedSquare))
+        && !(bishopAttacksFor<B>(info.kingSquare, occupiedAfter) & enemyBishopsQueens)
+        && !(rookAttacksFor<B>(info.kingSquare, occupiedAfter) & enemyRooksQueens);
+}
 
-        // If the checking piece is a rook or queen and the attack is on the same rank (horizontal attack)
-        if((checkingPieceType == 3 || checkingPieceType == 4 || checkingPieceType == 9 || checkingPieceType == 10) && kingRank == pieceRank) {
-            int direction = (fileDelta > 0) ? 1 : -1;  // Right or left
-            for (int file = kingFile + direction; file != pieceFile; file += direction) {
-                blockingMask |= (1ULL << (kingRank * 8 + file));  // Set bit for each square between king and piece
-            }
-        } 
+template<Color Us, Board::SliderBackend B>
+void Board::generateMovesFor(MoveList& moves, GenType type) {
 
-        // If the checking piece is a rook or queen and the attack is on the same file (vertical attack)
-        if((checkingPieceType == 3 || checkingPieceType == 4 || checkingPieceType == 9 || checkingPieceType == 10) && kingFile == pieceFile) {
-            int direction = (rankDelta > 0) ? 8 : -8;  // Up or down
-            for (int rank = kingRank + (direction / 8); rank != pieceRank; rank += (direction / 8)) {
-                blockingMask |= (1ULL << (rank * 8 + kingFile));  // Set bit for each square between king and piece
-            }
-        }
-            // If the checking piece is a bishop or queen and the attack is along a diagonal
-        if(checkingPieceType == 2 || checkingPieceType == 4 || checkingPieceType == 8 || checkingPieceType == 10) {
-            int direction = ((rankDelta > 0) ? 8 : -8) + ((fileDelta > 0) ? 1 : -1);  // Diagonal direction
-            for (int square = kingSquare + direction; square != kingAttackedAtSquare; square += direction) {
-                blockingMask |= (1ULL << square);  // Set bit for each square between king and piece
-            }
-        }
+    moves.clear();
+    MoveList quietMoves;
+    MoveList& quiets = (type == ALL || type == EVASIONS) ? quietMoves : moves;
 
+    // The checks, pins and king danger squares, shared with isKingInCheck() and isGameOver() for this position
+    PositionInfo scratch;
+    const PositionInfo& info = positionInfo(scratch);
+    if (info.kingSquare < 0) {
+        return;
+    }
 
-        // std:: cout << "Blocking Mask\n";
-        // std::bitset<64> printing(blockingMask);
-        // for (int i = 0; i < 64; i++) {
-        //     std::cout << printing[i];
-        //     if ((i + 1) % 8 == 0) {
-        //         std::cout << std::endl;
-        //     }
-        // }
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;  // White pieces start at 0, Black pieces start at 6
+    const int colour = Us;
 
+    uint64_t pawns = bitboards[playerPieceType];
+    uint64_t knights = bitboards[playerPieceType + 1];
 
-    // Check pawn normal move / double move
-    uint64_t blockingMaskCopy = blockingMask;
-    uint64_t pawnsCopy = pawns;
+    int kingSquare = info.kingSquare;
+    uint64_t kingDangerSquares = info.kingDanger;
+    uint64_t checkers = info.checkers;
+    uint64_t checkMask = info.checkMask;
+    uint64_t pinned = info.pinned;
+    int kingAttacks = popCount(checkers); // for double check or single check
 
-    // For white pawns
-    if (whiteToMove) {
-        while (blockingMaskCopy) {
-            int square = __builtin_ctzll(blockingMaskCopy);  // Get the least significant bit set
+    uint64_t opponentPieces = occupancy[colour ^ 1];
 
-            if(((xrayBitboard & (1ULL << square)))) {
-                blockingMaskCopy &= blockingMaskCopy - 1;
-                continue; // if the pawn is pinned we can't move it
-            }
+    // The destination squares this call is asked for
+    uint64_t captureTargets = (type == QUIETS) ? 0ULL : opponentPieces;
+    uint64_t quietTargets = (type == CAPTURES) ? 0ULL : ~occupied;
 
-            // Check if a white pawn can move 1 square forward
-            if ((square >= 8) && ((1ULL << (square + 8)) & pawnsCopy)) {
-                // Ensure the square is within bounds and the destination is occupied by a pawn
-                //std::cout << "White pawn can move from " << (square + 8) << " to " << square << std::endl;
-                legalMoves.push_back(Move(square + 8, square, 0, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
+    if (type == EVASIONS && kingAttacks == 0) {
+        return;
+    }
 
-            // Check if a white pawn can move 2 squares forward from the starting rank
-            if ((square >= 16) && (square / 8 == 3) && ((1ULL << (square + 16)) & pawnsCopy)) {
-                // Ensure the square is within bounds and the destination is occupied by a pawn
-                //std::cout << "White pawn can move from " << (square + 16) << " to " << square << std::endl;
-                legalMoves.push_back(Move(square + 16, square, 0, -1, -1, -1, Move::MoveType::MovedTwice, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
+    // ******************************************************************************
+    //      -> if in double check, you can only evade
+    //      -> if in single check, then evade, captures or block the check
+    //      -> en passant checks
+    // ******************************************************************************
 
-            // Clear the least significant bit
-            blockingMaskCopy &= blockingMaskCopy - 1;
+    // The king can always step out of the way, as long as the square isn't attacked
+    uint64_t kingMoves = getKingAttacks(kingSquare) & (captureTargets | quietTargets) & ~kingDangerSquares;
+    while (kingMoves) {
+        int toSquare = __builtin_ctzll(kingMoves);
+        if (opponentPieces & (1ULL << toSquare)) {
+            moves.push_back(Move(kingSquare, toSquare, Move::MoveType::Capture));
+        } else {
+            quiets.push_back(Move(kingSquare, toSquare, Move::MoveType::Normal));
         }
+        kingMoves &= kingMoves - 1;
     }
-        // For black pawns
-        else {
-            while (blockingMaskCopy) {
-                int square = __builtin_ctzll(blockingMaskCopy);  // Get the least significant bit set
 
-            if(((xrayBitboard & (1ULL << square)))) {
-                blockingMaskCopy &= blockingMaskCopy - 1;
-                continue; // if the pawn is pinned we can't move it
+    if(kingAttacks == 2) { // No other moves can be made if in double check
+        if (type == ALL || type == EVASIONS) {
+            for (int i = 0; i < quietMoves.size(); i++) {
+                moves.push_back(quietMoves[i]);
             }
+        }
+        return;
+    }
 
+    // Generate castling moves, only possible when not in check
+    if(kingAttacks == 0 && type != CAPTURES) {
+        if(canCastle((Us == WHITE) ? WHITE_KING_SIDE : BLACK_KING_SIDE, kingDangerSquares)) {
+            quiets.push_back((Us == WHITE) ? Move(60, 62, Move::MoveType::CastleKingSide) : Move(4, 6, Move::MoveType::CastleKingSide));
+        }
+        if(canCastle((Us == WHITE) ? WHITE_QUEEN_SIDE : BLACK_QUEEN_SIDE, kingDangerSquares)) {
+            quiets.push_back((Us == WHITE) ? Move(60, 58, Move::MoveType::CastleQueenSide) : Move(4, 2, Move::MoveType::CastleQueenSide));
+        }
+    }
 
-                // Check if a black pawn can move 1 square forward
-                if ((square < 56) && ((1ULL << (square - 8)) & pawnsCopy)) {
-                    // Ensure the square is within bounds and the destination is occupied by a pawn
-                    //std::cout << "Black pawn can move from " << (square - 8) << " to " << square << std::endl;
-                    legalMoves.push_back(Move(square - 8, square, 6, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-
-                // Check if a black pawn can move 2 squares forward from the starting rank
-                if ((square < 48) && (square / 8 == 4) && ((1ULL << (square - 16)) & pawnsCopy)) {
-                    // Ensure the square is within bounds and the destination is occupied by a pawn
-                    //std::cout << "Black pawn can move from " << (square - 16) << " to " << square << std::endl;
-                    legalMoves.push_back(Move(square - 16, square, 6, -1, -1, -1, Move::MoveType::MovedTwice, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
+    // ******************************************************************************
+    // now we can generate the moves of every other piece, limited to checkMask and to the pin line of pinned pieces
+    // ******************************************************************************
 
-                // Clear the least significant bit
-                blockingMaskCopy &= blockingMaskCopy - 1;
-            }
-        }
+    // Generate pawn moves
+    // The pawns that aren't pinned all at once, limited to the check mask. A pinned pawn also has to stay on its
+    // pin line, so each one is done as a set of one pawn with its own mask
+    generatePawnMoves<Us>(pawns & ~pinned, checkMask, type, moves, quiets);
+    uint64_t pinnedPawns = pawns & pinned;
+    while (pinnedPawns) {
+        int fromSquare = __builtin_ctzll(pinnedPawns);
+        generatePawnMoves<Us>(1ULL << fromSquare, checkMask & getLine(kingSquare, fromSquare), type, moves, quiets);
+        pinnedPawns &= pinnedPawns - 1;
+    }
 
-        // check knight moves
-        knightCopy = knights;
-        while(knightCopy) {
-            int square = __builtin_ctzll(knightCopy);
-            if(((xrayBitboard & (1ULL << square)))) {
-                knightCopy &= knightCopy - 1;
-                continue; // if the knight is pinned we can't move it
+    // En passant capture handling
+    if (type != QUIETS && enPassantSquare != -1) {
+        // Our pawns that attack the square are the ones an enemy pawn standing on it would attack
+        uint64_t enPassantPawns = pawns & getPawnAttacks(colour ^ 1, enPassantSquare);
+        while (enPassantPawns) {
+            int fromSquare = __builtin_ctzll(enPassantPawns);
+            if (isEnPassantLegal<Us, B>(fromSquare, info)) {
+                moves.push_back(Move(fromSquare, enPassantSquare, Move::MoveType::EnPassantCapture));
             }
-            uint64_t knightMoves = generateKnightAttacks(square);
-            if(knightMoves & blockingMask) {
-                //std::cout << "Knight can move from " << square << " to " << __builtin_ctzll(blockingMask&knightMoves)  << std::endl;
-                legalMoves.push_back(Move(square, __builtin_ctzll(blockingMask&knightMoves), playerPieceType + 1, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            knightCopy &= knightCopy - 1;
+            enPassantPawns &= enPassantPawns - 1;
         }
+    }
 
-        // check bishop queen moves
-        bishopQueensCopy = bishopQueens;
-        while(bishopQueensCopy) {
-            int square = __builtin_ctzll(bishopQueensCopy);
-            if(((xrayBitboard & (1ULL << square)))) {
-                bishopQueensCopy &= bishopQueensCopy - 1;
-                continue; // if the bishop is pinned we can't move it
-            }
-            uint64_t bishopMoves = generateBishopAttacks(square, blockers);
-            if(bishopMoves & blockingMask) {
-                //std::cout << "Bishop can move from " << square << " to " << __builtin_ctzll(blockingMask&bishopMoves) << std::endl;
-                legalMoves.push_back(Move(square, __builtin_ctzll(blockingMask&bishopMoves), playerPieceType + 2, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            bishopQueensCopy &= bishopQueensCopy - 1;
-        }
 
-        // check rook queen moves
-        rookQueensCopy = rookQueens;
-        while(rookQueensCopy) {
-            int square = __builtin_ctzll(rookQueensCopy);
+    // Generate knight moves
+    uint64_t playerKnightsMask = knights & ~pinned; // a pinned knight can never stay on the pin line
+    while (playerKnightsMask) {
+        int fromSquare = __builtin_ctzll(playerKnightsMask);
+        uint64_t knightAttacks = getKnightAttacks(fromSquare) & (captureTargets | quietTargets) & checkMask;
+        
+        while (knightAttacks) {
+            int toSquare = __builtin_ctzll(knightAttacks);
 
-            if(((xrayBitboard & (1ULL << square)))) {
-                rookQueensCopy &= rookQueensCopy - 1;
-                continue; // if the rook is pinned we can't move it
-            }
-            uint64_t rookMoves = generateRookAttacks(square, blockers);
-            if(rookMoves & blockingMask) {
-                //std::cout << "Rook can move from " << square << " to " << __builtin_ctzll(blockingMask&rookMoves) << std::endl;
-                legalMoves.push_back(Move(square, __builtin_ctzll(blockingMask&rookMoves), playerPieceType + 3, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
+            // Check if the target square contains an opponent's piece
+            if (opponentPieces & (1ULL << toSquare)) {
+                // Capture move
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
+            } else {
+                // Normal move
+                quiets.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
             }
-            rookQueensCopy &= rookQueensCopy - 1;
+            
+            knightAttacks &= knightAttacks - 1;
         }
-
-        return legalMoves;
+        
+        playerKnightsMask &= playerKnightsMask - 1;
     }
 
-    // ******************************************************************************
-    // At this stage our king is not in check, so we can generate all the legal moves but we have to be careful of
-    // pinned pieces, we will generate ALL pseudo legal moves but take into account the xray attacks for pinned pieces.
-    // 3) -> pinned pieces
-    /*
-        1 -Moves from the opponent’s sliding pieces.
-        2 -“Sliding attacking” moves from my king in the opposite direction.
-        3 -The overlap of these two rays.
-        If the result of 3) lands on one of my pieces, then it is pinned.
 
-        Once all the pinned pieces are identified, you can remove them from the board and calculate the moves from the enemy’s pinning piece to your king. This will give you a “ray” of legal moves for each of your pinned pieces.
+    // Generate bishop, rook and queen moves
+    for (int pieceType = playerPieceType + 2; pieceType <= playerPieceType + 4; ++pieceType) {
+        uint64_t playerSlidersMask = bitboards[pieceType];
+        while (playerSlidersMask) {
+            int fromSquare = __builtin_ctzll(playerSlidersMask);
+            uint64_t allowed = checkMask & (captureTargets | quietTargets);
+            if (pinned & (1ULL << fromSquare)) {
+                allowed &= getLine(kingSquare, fromSquare);
+            }
 
-        Note that since knights can only move in an L-shape, they can never move along a pin ray. The only piece types you need to consider are:
+            uint64_t sliderAttacks = 0;
+            if (pieceType != playerPieceType + 3) sliderAttacks |= bishopAttacksFor<B>(fromSquare, occupied);
+            if (pieceType != playerPieceType + 2) sliderAttacks |= rookAttacksFor<B>(fromSquare, occupied);
+            sliderAttacks &= allowed;
 
-        On a diagonal ray: bishops, queens, and pawns (captures only).
-        On a non-diagonal ray: rooks, queens, and pawns (pushes only).
-    */
-   // ******************************************************************************
+            while (sliderAttacks) {
+                int toSquare = __builtin_ctzll(sliderAttacks);
 
+                if (opponentPieces & (1ULL << toSquare)) {
+                    // Capture move
+                    moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
+                } else {
+                    // Normal move (not blocked)
+                    quiets.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
+                }
 
-    vector<Move> importantMoves; // to optimize alpha beta pruning, we want to prioritize captures and castling moves
+                sliderAttacks &= sliderAttacks - 1;
+            }
 
-   uint64_t xrayBitboard = 0ULL; // get attack rays from all sliding pieces - will ignore one friendly piece
-    blockers |= king; // add the king to the blockers so that we can get the xray bitboard  
-    // Checking bishop/queen (diagonal) attacks
-    enemyBishopsQueensCopy = enemyBishopsQueens;
-    while (enemyBishopsQueensCopy) {
-        int square = __builtin_ctzll(enemyBishopsQueensCopy);
-        xrayBitboard |= generateBishopXRay(square, kingSquare, blockers);
-        enemyBishopsQueensCopy &= enemyBishopsQueensCopy - 1;
+            playerSlidersMask &= playerSlidersMask - 1;
+        }
     }
 
-    // Checking rook/queen (horizontal/vertical) attacks
-    rookAttacks = 0;
-    enemyRooksQueensCopy = enemyRooksQueens;
-    while (enemyRooksQueensCopy) {
-        int square = __builtin_ctzll(enemyRooksQueensCopy);
-        xrayBitboard |= generateRookXRay(square, kingSquare, blockers);
-        enemyRooksQueensCopy &= enemyRooksQueensCopy - 1;
+    // Then the quiet moves
+    if (type == ALL || type == EVASIONS) {
+        for (int i = 0; i < quietMoves.size(); i++) {
+            moves.push_back(quietMoves[i]);
+        }
     }
+}
 
+int Board::countLegalMoves() {
+    if (sliderBackend == PEXT) {
+        return whiteToMove ? countLegalMovesFor<WHITE, PEXT>() : countLegalMovesFor<BLACK, PEXT>();
+    }
+    return whiteToMove ? countLegalMovesFor<WHITE, MAGIC>() : countLegalMovesFor<BLACK, MAGIC>();
+}
 
-    // std:: cout << "xrayBitboard\n";
-    // std::bitset<64> xray(xrayBitboard);
-    // for (int i = 0; i < 64; i++) {
-    //     std::cout << xray[i];
-    //     if ((i + 1) % 8 == 0) {
-    //         std::cout << std::endl;
-    //     }
-    // }
-
-    // ******************************************************************************
-    // now we can generate all pseudo legal moves and take into account the !(fromSquare && xrayBitBoard)
-    // ******************************************************************************
-
-    uint64_t opponentPieces = enemyPawns | enemyKnights | enemyBishopsQueens | enemyRooksQueens | enemyKing;
+// The pawnTargets() generatePawnMoves() scans, counted: a promotion is four moves
+template<Color Us>
+int Board::countPawnMoves(uint64_t pawns, uint64_t targetMask) const {
+    PawnTargets t = pawnTargets<Us>(pawns, targetMask);
+    int count = popCount(t.singlePushes) + popCount(t.doublePushes)
+              + popCount(t.westCaptures) + popCount(t.eastCaptures);
+    int promotions = popCount((t.singlePushes | t.westCaptures) & t.promotionRank) + popCount(t.eastCaptures & t.promotionRank);
+    return count + 3 * promotions;
+}
 
+// legalMoveGeneration() without the moves: every piece's target set is limited the same way and popcounted
+template<Color Us, Board::SliderBackend B>
+int Board::countLegalMovesFor() {
+    PositionInfo scratch;
+    const PositionInfo& info = positionInfo(scratch);
+    if (info.kingSquare < 0) {
+        return 0;
+    }
 
-    //     std:: cout << "ORIGINAL opponent pieces\n";
-    //     std::bitset<64> sq3(opponentPieces);
-    //     for (int i = 0; i < 64; i++) {
-    //         std::cout << sq3[i];
-    //         if ((i + 1) % 8 == 0) {
-    //             std::cout << std::endl;
-    //         }
-    //     }
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
+    uint64_t playerPieces = occupancy[Us];
+    uint64_t pinned = info.pinned;
+    uint64_t checkMask = info.checkMask;
+    int kingSquare = info.kingSquare;
+    int kingAttacks = popCount(info.checkers);
 
-    uint64_t rooks = bitboards[playerPieceType + 3];
-    uint64_t bishops = bitboards[playerPieceType + 2];
-    uint64_t queens = bitboards[playerPieceType + 4];
+    int count = popCount(getKingAttacks(kingSquare) & ~playerPieces & ~info.kingDanger);
+    if (kingAttacks == 2) {
+        return count;
+    }
 
+    if (kingAttacks == 0) {
+        count += canCastle((Us == WHITE) ? WHITE_KING_SIDE : BLACK_KING_SIDE, info.kingDanger);
+        count += canCastle((Us == WHITE) ? WHITE_QUEEN_SIDE : BLACK_QUEEN_SIDE, info.kingDanger);
+    }
 
+    uint64_t pawns = bitboards[playerPieceType];
+    count += countPawnMoves<Us>(pawns & ~pinned, checkMask);
+    uint64_t pinnedPawns = pawns & pinned;
+    while (pinnedPawns) {
+        int fromSquare = __builtin_ctzll(pinnedPawns);
+        count += countPawnMoves<Us>(1ULL << fromSquare, checkMask & getLine(kingSquare, fromSquare));
+        pinnedPawns &= pinnedPawns - 1;
+    }
+    if (enPassantSquare != -1) {
+        uint64_t enPassantPawns = pawns & getPawnAttacks(Us ^ 1, enPassantSquare);
+        while (enPassantPawns) {
+            count += isEnPassantLegal<Us, B>(__builtin_ctzll(enPassantPawns), info);
+            enPassantPawns &= enPassantPawns - 1;
+        }
+    }
 
-    // Generate king moves
-    uint64_t playerKingMask = king;
-    while (playerKingMask) {
-        int fromSquare = __builtin_ctzll(playerKingMask);
-        uint64_t kingAttacks = generateKingAttacks(fromSquare);
+    uint64_t targets = ~playerPieces & checkMask;
 
-        while (kingAttacks) {
-            int toSquare = __builtin_ctzll(kingAttacks);
-            uint64_t destinationMask = (1ULL << toSquare);
+    uint64_t knights = bitboards[playerPieceType + 1] & ~pinned;
+    while (knights) {
+        count += popCount(getKnightAttacks(__builtin_ctzll(knights)) & targets);
+        knights &= knights - 1;
+    }
 
-            if ((opponentPieces & destinationMask) && !(kingDangerSquares & destinationMask)) {
-                // Capture move
-                
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 5, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            } else if (!(blockers & destinationMask)) {
-                // Normal move (not blocked)
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 5, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            }
-            kingAttacks &= kingAttacks - 1;
-        }
-        playerKingMask &= playerKingMask - 1;
+    uint64_t bishopsQueens = bitboards[playerPieceType + 2] | bitboards[playerPieceType + 4];
+    while (bishopsQueens) {
+        int fromSquare = __builtin_ctzll(bishopsQueens);
+        uint64_t allowed = (pinned & (1ULL << fromSquare)) ? targets & getLine(kingSquare, fromSquare) : targets;
+        count += popCount(bishopAttacksFor<B>(fromSquare, occupied) & allowed);
+        bishopsQueens &= bishopsQueens - 1;
     }
 
-    // Generate castling moves
-    if(whiteToMove) {
-        if(whiteKingSideCastling) {
-            if(!(blockers & (1ULL << 61)) && !(blockers & (1ULL << 62)) && !isKingInCheck()) {
-                importantMoves.push_back(Move(60, 62, 5, -1, -1, -1, Move::MoveType::CastleKingSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
-        if(whiteQueenSideCastling) {
-            if(!(blockers & (1ULL << 57)) && !(blockers & (1ULL << 58)) && !isKingInCheck()) {
-                importantMoves.push_back(Move(60, 58, 5, -1, -1, -1, Move::MoveType::CastleQueenSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
-    } else {
-        if(blackKingSideCastling) {
-            if(!(blockers & (1ULL << 5)) && !(blockers & (1ULL << 6)) && !isKingInCheck()) {
-                importantMoves.push_back(Move(4, 6, 11, -1, -1, -1, Move::MoveType::CastleKingSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
-        if(blackQueenSideCastling) {
-            if(!(blockers & (1ULL << 1)) && !(blockers & (1ULL << 2)) && !isKingInCheck()) {
-                importantMoves.push_back(Move(4, 2, 11, -1, -1, -1, Move::MoveType::CastleQueenSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
+    uint64_t rooksQueens = bitboards[playerPieceType + 3] | bitboards[playerPieceType + 4];
+    while (rooksQueens) {
+        int fromSquare = __builtin_ctzll(rooksQueens);
+        uint64_t allowed = (pinned & (1ULL << fromSquare)) ? targets & getLine(kingSquare, fromSquare) : targets;
+        count += popCount(rookAttacksFor<B>(fromSquare, occupied) & allowed);
+        rooksQueens &= rooksQueens - 1;
     }
 
-    // Generate pawn moves
-    uint64_t playerPawnsMask = pawns;
-    while (playerPawnsMask) {
-        int fromSquare = __builtin_ctzll(playerPawnsMask);
-        if(((xrayBitboard & (1ULL << fromSquare)))) {
-            playerPawnsMask &= playerPawnsMask - 1;
-            continue; // if the pawn is pinned, we can't move it
-        }
-        bool isPromotingRank = (whiteToMove && fromSquare / 8 == 0) || (!whiteToMove && fromSquare / 8 == 7);
-        // Single pawn move (White moves down, Black moves up)
-        uint64_t singleMove = whiteToMove ? (1ULL << (fromSquare - 8)) : (1ULL << (fromSquare + 8));
-        if (!(blockers & singleMove) ) {
-            legalMoves.push_back(Move(fromSquare, __builtin_ctzll(singleMove), playerPieceType, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-        }
+    return count;
+}
 
-        // Double pawn move (White from rank 6, Black from rank 1)
-        if ((whiteToMove && (fromSquare / 8 == 6)) || (!whiteToMove && (fromSquare / 8 == 1))) {
-            uint64_t doubleMove = whiteToMove ? (1ULL << (fromSquare - 16)) : (1ULL << (fromSquare + 16));
-            if (!(blockers & (singleMove | doubleMove))  ) {
-                legalMoves.push_back(Move(fromSquare, __builtin_ctzll(doubleMove), playerPieceType, -1, -1, (fromSquare + (whiteToMove ? -8 : 8)), Move::MoveType::MovedTwice, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
+bool Board::hasAnyLegalMove() {
+    if (sliderBackend == PEXT) {
+        return whiteToMove ? hasAnyLegalMoveFor<WHITE, PEXT>() : hasAnyLegalMoveFor<BLACK, PEXT>();
+    }
+    return whiteToMove ? hasAnyLegalMoveFor<WHITE, MAGIC>() : hasAnyLegalMoveFor<BLACK, MAGIC>();
+}
 
-        // Pawn captures for the current pawn
-        uint64_t currentPawnCaptureMoves = whiteToMove ? 
-            (((1ULL << (fromSquare - 9)) & opponentPieces & ~FILE_A) | ((1ULL << (fromSquare - 7)) & opponentPieces & ~FILE_H)) :
-            (((1ULL << (fromSquare + 9)) & opponentPieces & ~FILE_H) | ((1ULL << (fromSquare + 7)) & opponentPieces & ~FILE_A));
+// countLegalMovesFor() that stops at the first move. The pieces are tried roughly in order of how likely they are
+// to have a move, so in a normal position this is the analysis and one or two lookups.
+// Castling is never needed: a legal castle means the king's step towards the rook is legal as well
+template<Color Us, Board::SliderBackend B>
+bool Board::hasAnyLegalMoveFor() {
+    PositionInfo scratch;
+    const PositionInfo& info = positionInfo(scratch);
+    if (info.kingSquare < 0) {
+        return false;
+    }
 
-        while (currentPawnCaptureMoves) {
-            int toSquare = __builtin_ctzll(currentPawnCaptureMoves);
-            if (!isPromotingRank   ) {
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType, pieceTypeAtSquare(toSquare), -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            currentPawnCaptureMoves &= currentPawnCaptureMoves - 1; // Clear the least significant bit
-        }
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
+    uint64_t playerPieces = occupancy[Us];
+    uint64_t pinned = info.pinned;
+    uint64_t checkMask = info.checkMask;
+    int kingSquare = info.kingSquare;
 
-        // Promotion handling
-        if (isPromotingRank ) {
-            int promotionSquare = fromSquare + (whiteToMove ? -8 : 8);
-            if (!(blockers & (1ULL << promotionSquare))) {
-                // Normal promotion moves
-                for (int promotedType = playerPieceType + 1; promotedType <= playerPieceType + 4; ++promotedType) {
-                    legalMoves.push_back(Move(fromSquare, promotionSquare, playerPieceType, -1, -1, promotedType, Move::MoveType::Promote, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-            }
-
-            // Promotion captures
-            currentPawnCaptureMoves = whiteToMove ? 
-                (((1ULL << (fromSquare - 9)) & opponentPieces & ~FILE_A) | ((1ULL << (fromSquare - 7)) & opponentPieces & ~FILE_H)) :
-                (((1ULL << (fromSquare + 9)) & opponentPieces & ~FILE_H) | ((1ULL << (fromSquare + 7)) & opponentPieces & ~FILE_A));
+    if (getKingAttacks(kingSquare) & ~playerPieces & ~info.kingDanger) {
+        return true;
+    }
+    if (info.checkers & (info.checkers - 1)) { // double check, only the king could have moved
+        return false;
+    }
 
-            while (currentPawnCaptureMoves) {
-                int toSquare = __builtin_ctzll(currentPawnCaptureMoves);
-                for (int promotedType = playerPieceType + 1; promotedType <= playerPieceType + 4; ++promotedType) {
-                    legalMoves.push_back(Move(fromSquare, toSquare, playerPieceType, pieceTypeAtSquare(toSquare), -1, promotedType, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-                currentPawnCaptureMoves &= currentPawnCaptureMoves - 1;
-            }
-        }
+    uint64_t targets = ~playerPieces & checkMask;
 
-        // En passant capture handling
-        if (enPassantSquare != -1 ) {
-            int enPassantTarget = whiteToMove ? (enPassantSquare + 8) : (enPassantSquare - 8);
-            if ((whiteToMove && (fromSquare / 8 == 4)) || (!whiteToMove && (fromSquare / 8 == 3))) {
-                if (fromSquare == enPassantTarget - (whiteToMove ? 9 : -9) || fromSquare == enPassantTarget - (whiteToMove ? 7 : -7)) {
-                    int enemyPawnSquare = whiteToMove ? (enPassantSquare - 8) : (enPassantSquare + 8);
-                    
-                    Move enpassant = Move(fromSquare, enPassantSquare, playerPieceType, pieceTypeAtSquare(enemyPawnSquare), enPassantSquare, -1, Move::MoveType::EnPassantCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling);
-                    makeMove(enpassant);
-                    if(!isKingInCheck()) {
-                        legalMoves.push_back(enpassant);
-                    }
-                    undoMove(enpassant);
-                }
-            }
+    uint64_t knights = bitboards[playerPieceType + 1] & ~pinned;
+    while (knights) {
+        if (getKnightAttacks(__builtin_ctzll(knights)) & targets) {
+            return true;
         }
-
-        playerPawnsMask &= playerPawnsMask - 1; // Clear the least significant bit
+        knights &= knights - 1;
     }
 
+    uint64_t pawns = bitboards[playerPieceType];
+    if (countPawnMoves<Us>(pawns & ~pinned, checkMask)) {
+        return true;
+    }
 
-    // Generate knight moves
-    uint64_t playerKnightsMask = knights;
-    while (playerKnightsMask) {
-        int fromSquare = __builtin_ctzll(playerKnightsMask);
-        if(((xrayBitboard & (1ULL << fromSquare)))) {
-            playerKnightsMask &= playerKnightsMask - 1;
-            continue; // if the knight is pinned, we can't move it
+    uint64_t bishopsQueens = bitboards[playerPieceType + 2] | bitboards[playerPieceType + 4];
+    while (bishopsQueens) {
+        int fromSquare = __builtin_ctzll(bishopsQueens);
+        uint64_t allowed = (pinned & (1ULL << fromSquare)) ? targets & getLine(kingSquare, fromSquare) : targets;
+        if (bishopAttacksFor<B>(fromSquare, occupied) & allowed) {
+            return true;
         }
-        uint64_t knightAttacks = generateKnightAttacks(fromSquare);
-        
-        while (knightAttacks) {
-            int toSquare = __builtin_ctzll(knightAttacks);
+        bishopsQueens &= bishopsQueens - 1;
+    }
 
-            // Check if the target square contains an opponent's piece
-            if (opponentPieces & (1ULL << toSquare)) {
-                // Capture move
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 1, pieceTypeAtSquare(toSquare), -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            } else if (!(blockers & (1ULL << toSquare))) {
-                // Normal move
-                legalMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 1, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            
-            knightAttacks &= knightAttacks - 1;
+    uint64_t rooksQueens = bitboards[playerPieceType + 3] | bitboards[playerPieceType + 4];
+    while (rooksQueens) {
+        int fromSquare = __builtin_ctzll(rooksQueens);
+        uint64_t allowed = (pinned & (1ULL << fromSquare)) ? targets & getLine(kingSquare, fromSquare) : targets;
+        if (rookAttacksFor<B>(fromSquare, occupied) & allowed) {
+            return true;
         }
-        
-        playerKnightsMask &= playerKnightsMask - 1;
+        rooksQueens &= rooksQueens - 1;
     }
 
-
-
-    // Generate bishop moves
-    uint64_t playerBishopsMask = bishops;
-    while (playerBishopsMask) {
-        int fromSquare = __builtin_ctzll(playerBishopsMask);
-        if(((xrayBitboard & (1ULL << fromSquare)))) {
-            playerBishopsMask &= playerBishopsMask - 1;
-            continue; // if the bishop is pinned, we can't move it
+    // Rarely matter, so last: pinned pawns moving along the pin and en passant
+    uint64_t pinnedPawns = pawns & pinned;
+    while (pinnedPawns) {
+        int fromSquare = __builtin_ctzll(pinnedPawns);
+        if (countPawnMoves<Us>(1ULL << fromSquare, checkMask & getLine(kingSquare, fromSquare))) {
+            return true;
         }
-        uint64_t bishopAttacks = generateBishopAttacks(fromSquare, blockers);
-        
-        while (bishopAttacks) {
-            int toSquare = __builtin_ctzll(bishopAttacks);
-            uint64_t destinationMask = (1ULL << toSquare);
-            
-            if (opponentPieces & destinationMask ) {
-                // Capture move
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 2, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            } else if (!(blockers & destinationMask)) {
-                // Normal move (not blocked)
-                legalMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 2, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+        pinnedPawns &= pinnedPawns - 1;
+    }
+    if (enPassantSquare != -1) {
+        uint64_t enPassantPawns = pawns & getPawnAttacks(Us ^ 1, enPassantSquare);
+        while (enPassantPawns) {
+            if (isEnPassantLegal<Us, B>(__builtin_ctzll(enPassantPawns), info)) {
+                return true;
             }
-            
-            bishopAttacks &= bishopAttacks - 1;
+            enPassantPawns &= enPassantPawns - 1;
         }
-        
-        playerBishopsMask &= playerBishopsMask - 1;
     }
 
+    return false;
+}
 
-    // Generate rook moves
-    uint64_t playerRooksMask = rooks;
-    while (playerRooksMask) {
-        int fromSquare = __builtin_ctzll(playerRooksMask);
-        if(((xrayBitboard & (1ULL << fromSquare)))) {
-            playerRooksMask &= playerRooksMask - 1;
-            continue; // if the rook is pinned, we can't move it
-        }
-        uint64_t rookAttacks = generateRookAttacks(fromSquare, blockers);
-        
-        while (rookAttacks) {
-            int toSquare = __builtin_ctzll(rookAttacks);
-            uint64_t destinationMask = (1ULL << toSquare);
+bool Board::isLegalQuiet(const Move& move) {
+    return whiteToMove ? isLegalQuietFor<WHITE>(move) : isLegalQuietFor<BLACK>(move);
+}
 
-            if (opponentPieces & destinationMask  ) {
-                // Capture move
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 3, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            } else if (!(blockers & destinationMask) ) {
-                // Normal move (not blocked)
-                legalMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 3, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            }
+// The generator's rules for one move: the piece has to be able to get there on this board, and then the
+// same king danger, check and pin masks apply. Sliders only need the squares between to be empty
+template<Color Us>
+bool Board::isLegalQuietFor(const Move& move) {
+    const int playerPieceType = (Us == WHITE) ? 0 : 6;
+    const uint64_t promotionRank = (Us == WHITE) ? 0x00000000000000FFULL : 0xFF00000000000000ULL;
+    const int push = (Us == WHITE) ? -8 : 8;
 
-            rookAttacks &= rookAttacks - 1;
-        }
-        
-        playerRooksMask &= playerRooksMask - 1;
+    int fromSquare = move.getFromSquare();
+    int toSquare = move.getToSquare();
+    uint64_t toBit = 1ULL << toSquare;
+    int pieceType = pieceOnSquare[fromSquare] - playerPieceType;
+    if (move.isCapture() || pieceType < 0 || pieceType > 5 || (occupied & toBit)) {
+        return false;
     }
 
-    // Generate queen moves
-    uint64_t playerQueensMask = queens;
-    while (playerQueensMask) {
-        int fromSquare = __builtin_ctzll(playerQueensMask);
-        if(((xrayBitboard & (1ULL << fromSquare)))) {
-            playerQueensMask &= playerQueensMask - 1;
-            continue; // if the queen is pinned, we can't move it
-        }
-        uint64_t queenAttacks = generateBishopAttacks(fromSquare, blockers) | generateRookAttacks(fromSquare, blockers);
-        
-        while (queenAttacks) {
-            int toSquare = __builtin_ctzll(queenAttacks);
-            uint64_t destinationMask = (1ULL << toSquare);
-
-            if (opponentPieces & destinationMask ) {
-                // Capture move
-                importantMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 4, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            } else if (!(blockers & destinationMask)) {
-                // Normal move (not blocked)
-                legalMoves.push_back(Move(fromSquare, toSquare, playerPieceType + 4, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
-            }
+    PositionInfo scratch;
+    const PositionInfo& info = positionInfo(scratch);
+    if (info.kingSquare < 0) {
+        return false;
+    }
 
-            queenAttacks &= queenAttacks - 1;
-        }
-        
-        playerQueensMask &= playerQueensMask - 1;
+    Move::MoveType moveType = move.getMoveType();
+    if (moveType == Move::MoveType::CastleKingSide || moveType == Move::MoveType::CastleQueenSide) {
+        bool kingSide = moveType == Move::MoveType::CastleKingSide;
+        int kingFrom = (Us == WHITE) ? 60 : 4;
+        int kingTo = kingFrom + (kingSide ? 2 : -2);
+        int right = (Us == WHITE) ? (kingSide ? WHITE_KING_SIDE : WHITE_QUEEN_SIDE) : (kingSide ? BLACK_KING_SIDE : BLACK_QUEEN_SIDE);
+        return pieceType == 5 && fromSquare == kingFrom && toSquare == kingTo && !info.checkers && canCastle(right, info.kingDanger);
+    }
+
+    if (pieceType == 5) {
+        return moveType == Move::MoveType::Normal && (getKingAttacks(fromSquare) & toBit & ~info.kingDanger);
+    }
+    if (info.checkers & (info.checkers - 1)) { // double check, only the king can move
+        return false;
+    }
+
+    bool reachable = false;
+    if (pieceType == 0) {
+        if (moveType == Move::MoveType::MovedTwice) {
+            const uint64_t startRank = (Us == WHITE) ? 0x00FF000000000000ULL : 0x000000000000FF00ULL;
+            reachable = ((1ULL << fromSquare) & startRank) && toSquare == fromSquare + 2 * push && !(occupied & (1ULL << (fromSquare + push)));
+        } else if (toSquare == fromSquare + push) {
+            // Queen promotions are generated with the captures
+            reachable = (toBit & promotionRank) ? (moveType == Move::MoveType::Promote && move.getPromotedPiece() != 4)
+                                                : moveType == Move::MoveType::Normal;
+        }
+    } else if (moveType != Move::MoveType::Normal) {
+        return false;
+    } else if (pieceType == 1) {
+        reachable = getKnightAttacks(fromSquare) & toBit;
+    } else {
+        bool orthogonal = (fromSquare >> 3) == (toSquare >> 3) || (fromSquare & 7) == (toSquare & 7);
+        bool aligned = getLine(fromSquare, toSquare) != 0;
+        bool rightDirection = (pieceType == 4) ? aligned : (pieceType == 3) ? orthogonal : (aligned && !orthogonal);
+        reachable = rightDirection && !(getBetween(fromSquare, toSquare) & occupied);
     }
 
-    // ******************************************************************************
-    // en passant discovery check - edge case
-    // sometimes en passant cannot be played because of a discovery attack on your own king
-    // to handle this we will just use make move / unmake move for en passant moves and check if the king is in check
-    // ******************************************************************************
-    vector<Move> combinedMoves;
-    combinedMoves.reserve(importantMoves.size() + legalMoves.size());
+    if (!reachable || !(info.checkMask & toBit)) {
+        return false;
+    }
+    return !(info.pinned & (1ULL << fromSquare)) || (getLine(info.kingSquare, fromSquare) & toBit);
+}
 
-    // Insert importantMoves first
-    combinedMoves.insert(combinedMoves.end(), importantMoves.begin(), importantMoves.end());
+std::vector<Move> Board::pseudoLegalMoves() {
+    MoveList moves;
+    pseudoLegalMoves(moves);
+    return std::vector<Move>(moves.begin(), moves.end());
+}
 
-    // Then insert legalMoves
-    combinedMoves.insert(combinedMoves.end(), legalMoves.begin(), legalMoves.end());
-    return combinedMoves;
+void Board::pseudoLegalMoves(MoveList& moves) {
+    if (sliderBackend == PEXT) {
+        whiteToMove ? pseudoLegalMovesFor<WHITE, PEXT>(moves) : pseudoLegalMovesFor<BLACK, PEXT>(moves);
+    } else {
+        whiteToMove ? pseudoLegalMovesFor<WHITE, MAGIC>(moves) : pseudoLegalMovesFor<BLACK, MAGIC>(moves);
+    }
 }
 
-std::vector<Move> Board::pseudoLegalMoves() {
-    std::vector<Move> moves;
+template<Color Us, Board::SliderBackend B>
+void Board::pseudoLegalMovesFor(MoveList& moves) {
+    moves.clear();
 
     // Determine which player's moves to generate
-    bool isWhiteTurn = whiteToMove;
+    const bool isWhiteTurn = (Us == WHITE);
     int playerPieceType = isWhiteTurn ? 0 : 6;  // White pieces start at 0, Black pieces start at 6
-    int opponentPieceType = isWhiteTurn ? 6 : 0;
     
     uint64_t playerPawns = bitboards[playerPieceType];
     uint64_t playerKnights = bitboards[playerPieceType + 1];
@@ -1621,94 +1855,24 @@ std::vector<Move> Board::pseudoLegalMoves() {
     uint64_t playerQueens = bitboards[playerPieceType + 4];
     uint64_t playerKing = bitboards[playerPieceType + 5];
     
-    uint64_t opponentPawns = bitboards[opponentPieceType];
-    uint64_t opponentKnights = bitboards[opponentPieceType + 1];
-    uint64_t opponentBishops = bitboards[opponentPieceType + 2];
-    uint64_t opponentRooks = bitboards[opponentPieceType + 3];
-    uint64_t opponentQueens = bitboards[opponentPieceType + 4];
-    uint64_t opponentKing = bitboards[opponentPieceType + 5];
-
-    // Combine all opponent's pieces
-    uint64_t opponentPieces = opponentPawns | opponentKnights | opponentBishops | opponentRooks | opponentQueens | opponentKing;
-    
-    // Combine all blockers (pieces of both players)
-    uint64_t blockers = 0;
-    for (int i = 0; i < 12; ++i) {
-        blockers |= bitboards[i];
-    }
-
-
-
-
-
-    // Generate pawn moves
-    uint64_t playerPawnsMask = playerPawns;
-    while (playerPawnsMask) {
-        int fromSquare = __builtin_ctzll(playerPawnsMask);
-        bool isPromotingRank = (isWhiteTurn && fromSquare / 8 == 0) || (!isWhiteTurn && fromSquare / 8 == 7);
-        // Single pawn move (White moves down, Black moves up)
-        uint64_t singleMove = isWhiteTurn ? (1ULL << (fromSquare - 8)) : (1ULL << (fromSquare + 8));
-        if (!(blockers & singleMove)) {
-            //moves.push_back(Move(fromSquare, __builtin_ctzll(singleMove), playerPieceType, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-        }
+    // All of the opponent's pieces
+    uint64_t opponentPieces = occupancy[isWhiteTurn ? 1 : 0];
+    uint64_t blockers = occupied;
 
-        // Double pawn move (White from rank 6, Black from rank 1)
-        if ((isWhiteTurn && (fromSquare / 8 == 6)) || (!isWhiteTurn && (fromSquare / 8 == 1))) {
-            uint64_t doubleMove = isWhiteTurn ? (1ULL << (fromSquare - 16)) : (1ULL << (fromSquare + 16));
-            if (!(blockers & (singleMove | doubleMove))) {
-                moves.push_back(Move(fromSquare, __builtin_ctzll(doubleMove), playerPieceType, -1, -1, (fromSquare + (isWhiteTurn ? -8 : 8)), Move::MoveType::MovedTwice, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
 
-        // Pawn captures for the current pawn
-        uint64_t currentPawnCaptureMoves = isWhiteTurn ? 
-            (((1ULL << (fromSquare - 9)) & opponentPieces & ~FILE_A) | ((1ULL << (fromSquare - 7)) & opponentPieces & ~FILE_H)) :
-            (((1ULL << (fromSquare + 9)) & opponentPieces & ~FILE_H) | ((1ULL << (fromSquare + 7)) & opponentPieces & ~FILE_A));
 
-        while (currentPawnCaptureMoves) {
-            int toSquare = __builtin_ctzll(currentPawnCaptureMoves);
-            if (!isPromotingRank) {
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType, pieceTypeAtSquare(toSquare), -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-            currentPawnCaptureMoves &= currentPawnCaptureMoves - 1; // Clear the least significant bit
-        }
 
-        // Promotion handling
-        if (isPromotingRank) {
-            int promotionSquare = fromSquare + (isWhiteTurn ? -8 : 8);
-            if (!(blockers & (1ULL << promotionSquare))) {
-                // Normal promotion moves
-                for (int promotedType = playerPieceType + 1; promotedType <= playerPieceType + 4; ++promotedType) {
-                    moves.push_back(Move(fromSquare, promotionSquare, playerPieceType, -1, -1, promotedType, Move::MoveType::Promote, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-            }
 
-            // Promotion captures
-            currentPawnCaptureMoves = isWhiteTurn ? 
-                (((1ULL << (fromSquare - 9)) & opponentPieces & ~FILE_A) | ((1ULL << (fromSquare - 7)) & opponentPieces & ~FILE_H)) :
-                (((1ULL << (fromSquare + 9)) & opponentPieces & ~FILE_H) | ((1ULL << (fromSquare + 7)) & opponentPieces & ~FILE_A));
+    // Generate pawn moves, every pawn at once with no pin or check limits
+    generatePawnMoves<Us>(playerPawns, ~0ULL, ALL, moves, moves);
 
-            while (currentPawnCaptureMoves) {
-                int toSquare = __builtin_ctzll(currentPawnCaptureMoves);
-                for (int promotedType = playerPieceType + 1; promotedType <= playerPieceType + 4; ++promotedType) {
-                    moves.push_back(Move(fromSquare, toSquare, playerPieceType, pieceTypeAtSquare(toSquare), -1, promotedType, Move::MoveType::PromoteCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-                currentPawnCaptureMoves &= currentPawnCaptureMoves - 1;
-            }
+    // En passant capture handling
+    if (enPassantSquare != -1) {
+        uint64_t enPassantPawns = playerPawns & getPawnAttacks(isWhiteTurn ? BLACK : WHITE, enPassantSquare);
+        while (enPassantPawns) {
+            moves.push_back(Move(__builtin_ctzll(enPassantPawns), enPassantSquare, Move::MoveType::EnPassantCapture));
+            enPassantPawns &= enPassantPawns - 1;
         }
-
-        // En passant capture handling
-        if (enPassantSquare != -1) {
-            int enPassantTarget = isWhiteTurn ? (enPassantSquare + 8) : (enPassantSquare - 8);
-            if ((isWhiteTurn && (fromSquare / 8 == 4)) || (!isWhiteTurn && (fromSquare / 8 == 3))) {
-                if (fromSquare == enPassantTarget - (isWhiteTurn ? 9 : -9) || fromSquare == enPassantTarget - (isWhiteTurn ? 7 : -7)) {
-                    int enemyPawnSquare = isWhiteTurn ? (enPassantSquare - 8) : (enPassantSquare + 8);
-                    moves.push_back(Move(fromSquare, enPassantSquare, playerPieceType, pieceTypeAtSquare(enemyPawnSquare), enPassantSquare, -1, Move::MoveType::EnPassantCapture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-                }
-            }
-        }
-
-        playerPawnsMask &= playerPawnsMask - 1; // Clear the least significant bit
     }
 
 
@@ -1716,7 +1880,7 @@ std::vector<Move> Board::pseudoLegalMoves() {
     uint64_t playerKnightsMask = playerKnights;
     while (playerKnightsMask) {
         int fromSquare = __builtin_ctzll(playerKnightsMask);
-        uint64_t knightAttacks = generateKnightAttacks(fromSquare);
+        uint64_t knightAttacks = getKnightAttacks(fromSquare);
         
         while (knightAttacks) {
             int toSquare = __builtin_ctzll(knightAttacks);
@@ -1724,10 +1888,10 @@ std::vector<Move> Board::pseudoLegalMoves() {
             // Check if the target square contains an opponent's piece
             if (opponentPieces & (1ULL << toSquare)) {
                 // Capture move
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 1, pieceTypeAtSquare(toSquare), -1, -1, Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
             } else if (!(blockers & (1ULL << toSquare))) {
                 // Normal move
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 1, -1, -1, -1, Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
             }
             
             knightAttacks &= knightAttacks - 1;
@@ -1741,7 +1905,7 @@ std::vector<Move> Board::pseudoLegalMoves() {
     uint64_t playerBishopsMask = playerBishops;
     while (playerBishopsMask) {
         int fromSquare = __builtin_ctzll(playerBishopsMask);
-        uint64_t bishopAttacks = generateBishopAttacks(fromSquare, blockers);
+        uint64_t bishopAttacks = bishopAttacksFor<B>(fromSquare, blockers);
         
         while (bishopAttacks) {
             int toSquare = __builtin_ctzll(bishopAttacks);
@@ -1749,14 +1913,10 @@ std::vector<Move> Board::pseudoLegalMoves() {
             
             if (opponentPieces & destinationMask) {
                 // Capture move
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 2, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
             } else if (!(blockers & destinationMask)) {
                 // Normal move (not blocked)
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 2, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
             }
             
             bishopAttacks &= bishopAttacks - 1;
@@ -1770,7 +1930,7 @@ std::vector<Move> Board::pseudoLegalMoves() {
     uint64_t playerRooksMask = playerRooks;
     while (playerRooksMask) {
         int fromSquare = __builtin_ctzll(playerRooksMask);
-        uint64_t rookAttacks = generateRookAttacks(fromSquare, blockers);
+        uint64_t rookAttacks = rookAttacksFor<B>(fromSquare, blockers);
         
         while (rookAttacks) {
             int toSquare = __builtin_ctzll(rookAttacks);
@@ -1778,14 +1938,10 @@ std::vector<Move> Board::pseudoLegalMoves() {
 
             if (opponentPieces & destinationMask) {
                 // Capture move
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 3, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
             } else if (!(blockers & destinationMask)) {
                 // Normal move (not blocked)
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 3, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
             }
 
             rookAttacks &= rookAttacks - 1;
@@ -1798,7 +1954,7 @@ std::vector<Move> Board::pseudoLegalMoves() {
     uint64_t playerQueensMask = playerQueens;
     while (playerQueensMask) {
         int fromSquare = __builtin_ctzll(playerQueensMask);
-        uint64_t queenAttacks = generateBishopAttacks(fromSquare, blockers) | generateRookAttacks(fromSquare, blockers);
+        uint64_t queenAttacks = bishopAttacksFor<B>(fromSquare, blockers) | rookAttacksFor<B>(fromSquare, blockers);
         
         while (queenAttacks) {
             int toSquare = __builtin_ctzll(queenAttacks);
@@ -1806,14 +1962,10 @@ std::vector<Move> Board::pseudoLegalMoves() {
 
             if (opponentPieces & destinationMask) {
                 // Capture move
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 4, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
             } else if (!(blockers & destinationMask)) {
                 // Normal move (not blocked)
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 4, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
             }
 
             queenAttacks &= queenAttacks - 1;
@@ -1827,7 +1979,7 @@ std::vector<Move> Board::pseudoLegalMoves() {
     uint64_t playerKingMask = playerKing;
     while (playerKingMask) {
         int fromSquare = __builtin_ctzll(playerKingMask);
-        uint64_t kingAttacks = generateKingAttacks(fromSquare);
+        uint64_t kingAttacks = getKingAttacks(fromSquare);
         
         while (kingAttacks) {
             int toSquare = __builtin_ctzll(kingAttacks);
@@ -1835,14 +1987,10 @@ std::vector<Move> Board::pseudoLegalMoves() {
 
             if (opponentPieces & destinationMask) {
                 // Capture move
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 5, pieceTypeAtSquare(toSquare), -1, -1, 
-                                    Move::MoveType::Capture, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Capture));
             } else if (!(blockers & destinationMask)) {
                 // Normal move (not blocked)
-                moves.push_back(Move(fromSquare, toSquare, playerPieceType + 5, -1, -1, -1, 
-                                    Move::MoveType::Normal, whiteKingSideCastling, whiteQueenSideCastling, 
-                                    blackKingSideCastling, blackQueenSideCastling));
+                moves.push_back(Move(fromSquare, toSquare, Move::MoveType::Normal));
             }
 
             kingAttacks &= kingAttacks - 1;
@@ -1851,40 +1999,29 @@ std::vector<Move> Board::pseudoLegalMoves() {
         playerKingMask &= playerKingMask - 1;
     }
 
-    // Generate castling moves
-    if(isWhiteTurn) {
-        if(whiteKingSideCastling) {
-            if(!(blockers & (1ULL << 61)) && !(blockers & (1ULL << 62)) && !isKingInCheck()) {
-                moves.push_back(Move(60, 62, 5, -1, -1, -1, Move::MoveType::CastleKingSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
+    // Generate castling moves, only possible when not in check. canCastle() also keeps the king off attacked
+    // squares on the way, which the check filter below can't see
+    PositionInfo scratch;
+    const PositionInfo& info = positionInfo(scratch);
+    if(info.kingSquare >= 0 && !info.checkers) {
+        if(canCastle(isWhiteTurn ? WHITE_KING_SIDE : BLACK_KING_SIDE, info.kingDanger)) {
+            moves.push_back(isWhiteTurn ? Move(60, 62, Move::MoveType::CastleKingSide) : Move(4, 6, Move::MoveType::CastleKingSide));
         }
-        if(whiteQueenSideCastling) {
-            if(!(blockers & (1ULL << 57)) && !(blockers & (1ULL << 58)) && !isKingInCheck()) {
-                moves.push_back(Move(60, 58, 5, -1, -1, -1, Move::MoveType::CastleQueenSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
-    } else {
-        if(blackKingSideCastling) {
-            if(!(blockers & (1ULL << 5)) && !(blockers & (1ULL << 6)) && !isKingInCheck()) {
-                moves.push_back(Move(4, 6, 11, -1, -1, -1, Move::MoveType::CastleKingSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
-        }
-        if(blackQueenSideCastling) {
-            if(!(blockers & (1ULL << 1)) && !(blockers & (1ULL << 2)) && !isKingInCheck()) {
-                moves.push_back(Move(4, 2, 11, -1, -1, -1, Move::MoveType::CastleQueenSide, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling));
-            }
+        if(canCastle(isWhiteTurn ? WHITE_QUEEN_SIDE : BLACK_QUEEN_SIDE, info.kingDanger)) {
+            moves.push_back(isWhiteTurn ? Move(60, 58, Move::MoveType::CastleQueenSide) : Move(4, 2, Move::MoveType::CastleQueenSide));
         }
     }
-    for (int i = moves.size() - 1; i >= 0; i--) {
-        makeMove(moves[i]);
-        if (isKingInCheck()) {
-            undoMove(moves[i]);  // Undo the move before erasing
-            moves.erase(moves.begin() + i);
-        } else {
-            undoMove(moves[i]);  // Only undo if the move is valid
+    // Drop the moves that leave the king in check, compacting the survivors to the front of the list
+    int kept = 0;
+    StateInfo state;
+    for (int i = 0; i < moves.size(); i++) {
+        Move move = moves[i];
+        makeMoveFor<Us>(move, state);
+        bool legal = !isKingInCheckFor<Us, B>();
+        undoMoveFor<Us>(move, state);
+        if (legal) {
+            moves[kept++] = move;
         }
     }
-
-
-    return moves;
+    moves.resize(kept);
 }
@@ -4,91 +4,304 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <type_traits>
 #include "move.h"
 
 using Bitboard = uint64_t;
 
-class Board {
+// Side as a template parameter, so colour dependent code is resolved at compile time
+enum Color { WHITE, BLACK };
+
+// Bits set in a bitboard, the one way to count them anywhere in the engine. Without -mpopcnt __builtin_popcountll
+// is a call into libgcc, which is slower than counting in registers
+inline int popCount(Bitboard b) {
+#if defined(__POPCNT__)
+    return __builtin_popcountll(b);
+#else
+    b = b - ((b >> 1) & 0x5555555555555555ULL);
+    b = (b & 0x3333333333333333ULL) + ((b >> 2) & 0x3333333333333333ULL);
+    b = (b + (b >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((b * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// The position itself: where the pieces are, the state that goes with them and its Zobrist key.
+// Board adds the move logic on top, and a pointer to the StateInfo that holds the analysis of the position
+class Position {
 public:
     Bitboard bitboards[12];
+    int8_t pieceOnSquare[64]; // piece type (0-11) on every square, -1 if empty. Kept in sync with bitboards by add/remove/movePiece
+    Bitboard occupancy[2];    // [0] = all white pieces, [1] = all black pieces, kept in sync the same way
+    Bitboard occupied;        // every piece on the board
 
-    const uint64_t FILE_A = 0x8080808080808080ULL;  // File A (1st column, flipped)
-    const uint64_t FILE_B = 0x4040404040404040ULL;  // File B (2nd column, flipped)
-    const uint64_t FILE_C = 0x2020202020202020ULL;  // File C (3rd column, flipped)
-    const uint64_t FILE_D = 0x1010101010101010ULL;  // File D (4th column, flipped)
-    const uint64_t FILE_E = 0x0808080808080808ULL;  // File E (5th column, flipped)
-    const uint64_t FILE_F = 0x0404040404040404ULL;  // File F (6th column, flipped)
-    const uint64_t FILE_G = 0x0202020202020202ULL;  // File G (7th column, flipped)
-    const uint64_t FILE_H = 0x0101010101010101ULL;  // File H (8th column, flipped)
-
-    const uint64_t RANK_1 = 0x00000000000000FFULL;  // Rank 1 (Bottom row, 1st rank)
-    const uint64_t RANK_2 = 0x000000000000FF00ULL;  // Rank 2
-    const uint64_t RANK_3 = 0x0000000000FF0000ULL;  // Rank 3
-    const uint64_t RANK_4 = 0x00000000FF000000ULL;  // Rank 4
-    const uint64_t RANK_5 = 0x000000FF00000000ULL;  // Rank 5
-    const uint64_t RANK_6 = 0x0000FF0000000000ULL;  // Rank 6
-    const uint64_t RANK_7 = 0x00FF000000000000ULL;  // Rank 7
-    const uint64_t RANK_8 = 0xFF00000000000000ULL;  // Rank 8 (Top row, 8th rank)
+protected:
+    int castlingRights;       // bits of Board::CastlingRight
+    int enPassantSquare;
+    int halfmoveClock;
+    int fullmoveNumber;
+    bool whiteToMove;
+    uint64_t hashKey;
+};
+
+class Board : public Position {
+public:
+
+    static constexpr uint64_t FILE_A = 0x8080808080808080ULL;  // File A (1st column, flipped)
+    static constexpr uint64_t FILE_B = 0x4040404040404040ULL;  // File B (2nd column, flipped)
+    static constexpr uint64_t FILE_C = 0x2020202020202020ULL;  // File C (3rd column, flipped)
+    static constexpr uint64_t FILE_D = 0x1010101010101010ULL;  // File D (4th column, flipped)
+    static constexpr uint64_t FILE_E = 0x0808080808080808ULL;  // File E (5th column, flipped)
+    static constexpr uint64_t FILE_F = 0x0404040404040404ULL;  // File F (6th column, flipped)
+    static constexpr uint64_t FILE_G = 0x0202020202020202ULL;  // File G (7th column, flipped)
+    static constexpr uint64_t FILE_H = 0x0101010101010101ULL;  // File H (8th column, flipped)
+
+    static constexpr uint64_t RANK_1 = 0x00000000000000FFULL;  // Rank 1 (Bottom row, 1st rank)
+    static constexpr uint64_t RANK_2 = 0x000000000000FF00ULL;  // Rank 2
+    static constexpr uint64_t RANK_3 = 0x0000000000FF0000ULL;  // Rank 3
+    static constexpr uint64_t RANK_4 = 0x00000000FF000000ULL;  // Rank 4
+    static constexpr uint64_t RANK_5 = 0x000000FF00000000ULL;  // Rank 5
+    static constexpr uint64_t RANK_6 = 0x0000FF0000000000ULL;  // Rank 6
+    static constexpr uint64_t RANK_7 = 0x00FF000000000000ULL;  // Rank 7
+    static constexpr uint64_t RANK_8 = 0xFF00000000000000ULL;  // Rank 8 (Top row, 8th rank)
 
 
     /*
         Precomputed Attack Bitboards    
     */
-   void precomputeAttackBitboards();
-   uint64_t knightAttacks[64];
-   uint64_t getKnightAttacks(int square);
+   // Builds the shared tables below the first time it is called; later calls, from any thread, wait for that one
+   static void precomputeAttackBitboards();
+   static uint64_t knightAttacks[64];
+   uint64_t getKnightAttacks(int square) const;
+
+   // Board geometry, shared by every board
+   static uint64_t kingAttackTable[64];
+   static uint64_t pawnAttackTable[2][64];  // [0] = squares a white pawn attacks, [1] = black pawn
+   static uint64_t betweenMasks[64][64];    // squares strictly between two squares on a common rank, file or diagonal
+   static uint64_t lineMasks[64][64];       // the whole rank, file or diagonal through both squares (0 if not aligned)
+   uint64_t getKingAttacks(int square) const { return kingAttackTable[square]; }
+   uint64_t getPawnAttacks(int colour, int square) const { return pawnAttackTable[colour][square]; }
+   uint64_t getBetween(int square1, int square2) const { return betweenMasks[square1][square2]; }
+   uint64_t getLine(int square1, int square2) const { return lineMasks[square1][square2]; }
 
+   // Fancy magic bitboards: every square owns a slice of one shared attack table,
+   // sized to the number of relevant blocker subsets for that square
+   struct SliderMagic {
+       uint64_t mask;      // relevant blockers (ray squares without the board edge)
+       uint64_t magic;
+       uint64_t* attacks;  // this square's slice of sliderAttackTable
+       unsigned shift;
+   };
+   static SliderMagic bishopMagics[64];
+   static SliderMagic rookMagics[64];
+   static uint64_t sliderAttackTable[5248 + 102400]; // all bishop slices followed by all rook slices
+   static uint64_t* initSliderMagics(SliderMagic magics[], uint64_t* table, bool bishop);
 
+   // The slices are indexed with PEXT on CPUs where it is fast, otherwise with the magic multiply.
+   // Picked once at startup from CPUID, so the same binary runs on both
+   enum class SliderBackend { Magic, Pext };
+   static SliderBackend sliderBackend;
+   static bool cpuHasFastPext();
+   static const char* sliderBackendName();
 
+   // Zobrist keys: a random number per piece on every square, per castling right, per en passant file
+   // and for black to move. A position's key is the XOR of the numbers for everything that is true in it
+   static uint64_t zobristPieceSquare[12][64];
+   static uint64_t zobristCastling[16];     // indexed by the castling rights bits, so every combination has one key
+   static uint64_t zobristEnPassantFile[8];
+   static uint64_t zobristBlackToMove;
+   static void initZobristKeys();
 
 
+
+
+
+    // What makeMove() can't recover from the move itself, and the analysis of the position it leads to. The caller
+    // keeps one per ply, on its own stack next to the move, and hands the same one back to undoMove(). The board
+    // points at it in between, so it has to live until the move is undone or the board is set up again
+    struct StateInfo;
+
     void setupInitialPosition();
     std::vector<std::string> split(const std::string& str, char delimiter);
-    void setupPosition(const std::string& fen);
-    void removePiece(int pieceType, int square);
-    void addPiece(int pieceType, int square);
-    void movePiece(int pieceType, int fromSquare, int toSquare);
+    // rootState, if given, keeps the analysis of the position like the StateInfo of a move does. It isn't undone
+    void setupPosition(const std::string& fen, StateInfo* rootState = nullptr);
     void printFENBoard();
     void printSingleBitboards();
     void printBitboard(uint64_t bb) const;
     void printJustFENBoard();
     int coordinateToBitboardIndex(const std::string& coordinate) const;
-    int pieceTypeAtSquare(int square);
-    void makeMove(const Move& move);
-    void undoMove(const Move& move);
+    int pieceTypeAtSquare(int square) const {
+        return pieceOnSquare[square];
+    }
+    void makeMove(const Move& move, StateInfo& state);
+    void undoMove(const Move& move, const StateInfo& state);
     void flipColour();
 
     bool isKingInCheck();
     std::vector<Move> legalMoveGeneration();
     std::vector<Move> pseudoLegalMoves();
+    // Same as above but written into a caller's MoveList, for the search where allocating would hurt
+    void legalMoveGeneration(MoveList& moves);
+    void pseudoLegalMoves(MoveList& moves);
+
+    // What the move generator works out about the side to move before generating anything. Computed once per
+    // position and kept in the StateInfo of the move that led there, so isKingInCheck() and isGameOver() at the same
+    // node read it instead of redoing the attack lookups, and the parent's is still there after undoMove().
+    // A position set up from a FEN has no StateInfo, so there it is worked out into the caller's scratch every time
+    struct PositionInfo {
+        uint64_t checkers;    // enemy pieces giving check
+        uint64_t checkMask;   // squares a non king move must land on to answer a single check (all squares if none)
+        uint64_t pinned;      // our pieces pinned to our king, each can only move on line[king][piece]
+        uint64_t kingDanger;  // squares the enemy attacks, looking through our king
+        int kingSquare;       // -1 if a king is missing
+        bool valid;
+    };
+    const PositionInfo& positionInfo(PositionInfo& scratch);
+
+    // Where the side to move would give check from, so givesCheck() can answer without making the move.
+    // Worked out the first time it is asked for at a position and kept next to PositionInfo
+    struct CheckInfo {
+        uint64_t checkSquares[6];     // squares from which each of our piece types (pawn ... king) would attack the enemy king
+        uint64_t discoveredCheckers;  // our pieces that are the only thing between one of our sliders and the enemy king
+        int enemyKingSquare;          // -1 if a king is missing
+        bool valid;
+    };
+    const CheckInfo& checkInfo(CheckInfo& scratch);
+
+    struct StateInfo {
+        // The state the move overwrote, put back by undoMove()
+        uint64_t hashKey;
+        int8_t capturedPieceType; // -1 if nothing was captured
+        int8_t enPassantSquare;
+        uint8_t castlingRights;
+        int16_t halfmoveClock;
+        StateInfo* previous;      // the board's StateInfo before the move, nullptr at a position set up from a FEN
+
+        // positionInfo() and checkInfo() of the position after the move. flipColour() marks them stale
+        PositionInfo positionInfo;
+        CheckInfo checkInfo;
+    };
+    // Whether a legal move of the side to move checks the enemy king, for move ordering, extensions and pruning
+    bool givesCheck(const Move& move);
+
+    // Which legal moves generateMoves() produces, so a search can generate the captures and the quiet moves in separate stages
+    enum GenType {
+        CAPTURES,   // captures, en passant and queen promotions
+        QUIETS,     // everything else: quiet moves, castling and under promotions
+        EVASIONS,   // every move out of check, captures first. Empty when not in check
+        ALL         // both, captures first
+    };
+    void generateMoves(MoveList& moves, GenType type);
+
+    // Legal moves of one kind only, e.g. captures for a quiescence search
+    void generateCaptures(MoveList& moves);
+    void generateQuiets(MoveList& moves);
+    void generateEvasions(MoveList& moves);
     int isGameOver();
 
-    uint64_t generateKnightAttacks(int square) const;
-    uint64_t generateBishopAttacks(int square, uint64_t blockers) const;
-    uint64_t generateRookAttacks(int square, uint64_t blockers) const;
-    uint64_t generateKingAttacks(int square) const;
+    // The number of legal moves, without making a list of them: for perft leaves, mobility and stalemate checks
+    int countLegalMoves();
+    // Whether there is a legal move at all, returning at the first one found: for checkmate and stalemate detection
+    bool hasAnyLegalMove();
+    // Whether a non capture move from elsewhere, e.g. a killer, is one of this position's QUIETS moves.
+    // Checks just that move instead of generating the quiet moves to look for it
+    bool isLegalQuiet(const Move& move);
+
+    static uint64_t generateKnightAttacks(int square);
+    static uint64_t generateBishopAttacks(int square, uint64_t blockers);
+    static uint64_t generateRookAttacks(int square, uint64_t blockers);
+    static uint64_t generateKingAttacks(int square);
 
-    uint64_t generateBishopXRay(int square, int kingSquare,  uint64_t blockers) const;
-    uint64_t generateRookXRay(int square, int kingSquare, uint64_t blockers) const;
+    // Ray walking versions, only used to fill the magic tables
+    static uint64_t slidingBishopAttacks(int square, uint64_t blockers);
+    static uint64_t slidingRookAttacks(int square, uint64_t blockers);
 
 
-    uint64_t kingDangerSquares() const;
+    // Every piece of either colour attacking the square, with the sliders blocked by the given occupancy.
+    // Passing an occupancy without some piece looks through it (x-rays for exchanges, the king for its escape squares)
+    uint64_t attackersTo(int square, uint64_t blockers) const;
+    uint64_t attackersTo(int square) const {
+        return attackersTo(square, occupied);
+    }
+    // Whether any piece of byColour attacks the square, returns as soon as one is found
+    bool isSquareAttacked(int square, Color byColour) const;
     bool isWhiteToMove() const {
         return whiteToMove;
     }
 
+    // Zobrist key of the current position, kept up to date by makeMove(), undoMove() and flipColour()
+    uint64_t getHashKey() const {
+        return hashKey;
+    }
+    uint64_t computeHashKey() const; // from scratch, to check the incremental key against
+
 private:
     
-    bool whiteKingSideCastling;
-    bool whiteQueenSideCastling;
-    bool blackKingSideCastling;
-    bool blackQueenSideCastling;
-    int enPassantSquare;
-    int halfmoveClock;
-    int fullmoveNumber;
-    volatile bool whiteToMove;
+    // Castling rights are bits of castlingRights
+    enum CastlingRight {
+        WHITE_KING_SIDE = 1,
+        WHITE_QUEEN_SIDE = 2,
+        BLACK_KING_SIDE = 4,
+        BLACK_QUEEN_SIDE = 8
+    };
+    static int castlingRightsMask[64]; // rights that survive a move from or to the square: the kings' and rooks' start squares clear theirs
+    static void buildAttackTables(); // the body of precomputeAttackBitboards(), run once
+
+    uint64_t castlingKey() const;
+    uint64_t enPassantKey() const;
+    void checkHashKey() const; // only does anything when built with -DBOARD_DEBUG
+
+    // Only for makeMove() and undoMove(): they keep the mailbox, the occupancy caches and the piece part of the
+    // Zobrist key in step with the bitboards, but leave the cached analyses alone, which makeMove() marks stale
+    void removePiece(int pieceType, int square);
+    void addPiece(int pieceType, int square);
+    void movePiece(int pieceType, int fromSquare, int toSquare);
+
+    // Colour and slider backend specialised bodies of the public functions above, which pick one of them once at
+    // the top of the call. Everything that looks up slider attacks takes the backend, so none of them branch on it
+    template<SliderBackend B> static uint64_t bishopAttacksFor(int square, uint64_t blockers);
+    template<SliderBackend B> static uint64_t rookAttacksFor(int square, uint64_t blockers);
+    template<SliderBackend B> uint64_t attackersToFor(int square, uint64_t blockers) const;
+    template<SliderBackend B> bool isSquareAttackedFor(int square, Color byColour) const;
+    template<Color Us, SliderBackend B> bool isKingInCheckFor();
+    template<Color Us, SliderBackend B> void analysePositionFor(PositionInfo& info);
+    template<Color Us, SliderBackend B> void analyseChecksFor(CheckInfo& info);
+    template<Color Us, SliderBackend B> bool givesCheckFor(const Move& move);
+    template<Color Us, SliderBackend B> void generateMovesFor(MoveList& moves, GenType type);
+    template<Color Us, SliderBackend B> void pseudoLegalMovesFor(MoveList& moves);
+    bool canCastle(int right, uint64_t kingDanger) const;
+    template<Color Us, SliderBackend B> bool isEnPassantLegal(int fromSquare, const PositionInfo& info) const;
+    template<Color Us, SliderBackend B> int countLegalMovesFor();
+    template<Color Us, SliderBackend B> bool hasAnyLegalMoveFor();
+    template<Color Us> bool isLegalQuietFor(const Move& move);
+    // Destination squares of a set of pawns, one bitboard per kind of move, limited to targetMask. Shared by
+    // generatePawnMoves() and countPawnMoves() so the two can't disagree about which pawn moves exist
+    struct PawnTargets {
+        uint64_t singlePushes;
+        uint64_t doublePushes;
+        uint64_t westCaptures;  // towards the a-file
+        uint64_t eastCaptures;  // towards the h-file
+        uint64_t promotionRank; // the row the pawns promote on, the part of the sets above that are promotions
+    };
+    template<Color Us> PawnTargets pawnTargets(uint64_t pawns, uint64_t targetMask) const;
+    template<Color Us> int countPawnMoves(uint64_t pawns, uint64_t targetMask) const;
+    // Pawn moves to squares in targetMask: captures and queen promotions into captures, the rest into quiets
+    template<Color Us> void generatePawnMoves(uint64_t pawns, uint64_t targetMask, GenType type, MoveList& captures, MoveList& quiets) const;
+    template<Color Us> void makeMoveFor(const Move& move, StateInfo& state);
+    template<Color Us> void undoMoveFor(const Move& move, const StateInfo& state);
+
+    void rebuildCachedBoards(); // fill pieceOnSquare and the occupancy bitboards from the bitboards after setting up a position
+
+    // StateInfo of the last move made, which holds the analysis of the current position. A copy of the board shares
+    // it until one of them makes a move, so make one on the copy before flipping its side or handing it to a thread
+    StateInfo* st;
     
     
 };
 
+// The masks and attack tables are all static, and the undo information and the analysis live in the caller's
+// StateInfos, so a Board is its Position and one pointer: 224 bytes on x86-64, 64 of them the pieceOnSquare mailbox.
+// The mailbox and occupancy caches are what keep it above a bare 128 byte position; they save a bitboard scan on
+// every piece lookup. Copying one is cheap enough for copy-make and to hand a position to another thread
+static_assert(std::is_trivially_copyable<Board>::value, "Board must stay trivially copyable");
+
 #endif // BOARD_H
@@ -1,11 +1,15 @@
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <string>
 #include <stdexcept>
+#include <cstdlib>
 
 #include "board.h"
 #include "move.h"
 #include "evaluation.h"
+#include "movepicker.h"
+#include "perft.h"
 
 #include <chrono>
 #include <future>
@@ -13,15 +17,19 @@
 #include <algorithm>
 #include <thread>
 // cd ~/Desktop/C++ChessEngine
-// g++ -std=c++11 -o chessengine.out main.cpp board.cpp move.cpp evaluation.cpp
+// g++ -std=c++11 -pthread -o chessengine.out main.cpp board.cpp move.cpp movepicker.cpp evaluation.cpp perft.cpp
 // ./chessengine.out
+// ./chessengine.out perft <depth> [FEN]     (or divide / hashperft <depth> [FEN]), the start position if no FEN is given
+// ./chessengine.out pperft <depth> [threads] [FEN]
+// ./chessengine.out bench [depth] [file.json]
+// ./chessengine.out test
 // rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
 
 using namespace std;
 
 int nodesSearched = 0;
 int maxDepth = 1;
-int bestMoveIndex = -1;
+Move bestMove = Move::none();
 double bestMoveEval = -1;
 int secondBestMoveIndex = -1;
 double secondBestEval = -1;
@@ -31,17 +39,36 @@ int threadNum = 4;
 
 vector<Move> principalVector; // stores the top variation of the search
 
+// Deepest line of moves the search, bench and perft commands are allowed to play out
+const int MAX_PLY = 64;
+
+// Two quiet moves per depth that caused a beta cutoff, tried early by the MovePicker at the same depth elsewhere in the tree
+Move killerMoves[MAX_PLY][2];
+
+const size_t PERFT_TABLE_MEGABYTES = 256; // for hashperft
+const int BENCH_DEPTH = 5;                 // default depth of the bench command
+
+void storeKiller(const Move& move, int depth) {
+    if (move.isCapture() || move.isPromotion() || move == killerMoves[depth][0]) {
+        return;
+    }
+    killerMoves[depth][1] = killerMoves[depth][0];
+    killerMoves[depth][0] = move;
+}
+
 void unitTest() {
 
     // Testing makeMoves()
     Board board;
+    Board::precomputeAttackBitboards();
+    Board::StateInfo state;
 
     // Normal Move
     board.setupPosition("8/8/8/8/8/8/8/P7 b - - 0 1");
     cout << "Before Normal Move: \n";
     board.printFENBoard();
-    Move move = Move(56, 48, 0, 0, 0, 0, Move::MoveType::Normal, true, true, true, true); // white pawn on a1 moves to a2
-    board.makeMove(move);
+    Move move = Move(56, 48, Move::MoveType::Normal); // white pawn on a1 moves to a2
+    board.makeMove(move, state);
     cout << "After Normal Move: \n";
     board.printFENBoard();
     if (board.pieceTypeAtSquare(48) != 0 || board.pieceTypeAtSquare(56) != -1) {
@@ -52,8 +79,8 @@ void unitTest() {
     board.setupPosition("8/8/8/8/8/8/8/P7 b - - 0 1");
     cout << "Before Moved Twice: \n";
     board.printFENBoard();
-    move = Move(56, 40, 0, 0, 0, 0, Move::MoveType::MovedTwice, true, true, true, true); // white pawn on a1 moves to a3
-    board.makeMove(move);
+    move = Move(56, 40, Move::MoveType::MovedTwice); // white pawn on a1 moves to a3
+    board.makeMove(move, state);
     cout << "After Moved Twice: \n";
     board.printFENBoard();
     if (board.pieceTypeAtSquare(40) != 0 || board.pieceTypeAtSquare(56) != -1) {
@@ -61,13 +88,13 @@ void unitTest() {
     }
 
     // Capture
-    // Move(fromSquare, toSquare, pieceType, capturedPiece, enPassantSquare, promotedPieceType, moveType, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling)
+    // Move(fromSquare, toSquare, moveType, promotedPiece)
 
     board.setupPosition("7n/8/8/8/8/8/8/7R w - - 0 1");
     cout << "Before Capture: \n";
     board.printFENBoard();
-    move = Move(63, 7, 3, 7, 0, 0, Move::MoveType::Capture, true, true, true, true); // white rook on h1 captures black knight at h8
-    board.makeMove(move);
+    move = Move(63, 7, Move::MoveType::Capture); // white rook on h1 captures black knight at h8
+    board.makeMove(move, state);
     cout << "After Capture: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(7) != 3 || board.pieceTypeAtSquare(63) != -1) {
@@ -78,8 +105,8 @@ void unitTest() {
     board.setupPosition("8/8/8/3pP3/8/8/8/8 w - d6 0 1");
     cout << "Before En Passant Capture: \n";
     board.printFENBoard();
-    move = Move(28, 19, 0, 6, 19, 0, Move::MoveType::EnPassantCapture, true, true, true, true); //  white pawn e5 captures black pawn on d5
-    board.makeMove(move);
+    move = Move(28, 19, Move::MoveType::EnPassantCapture); //  white pawn e5 captures black pawn on d5
+    board.makeMove(move, state);
     cout << "After En Passant Capture: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(19) != 0 || board.pieceTypeAtSquare(27) != -1 || board.pieceTypeAtSquare(28) != -1 ) {
@@ -90,8 +117,8 @@ void unitTest() {
     board.setupPosition("8/8/8/8/8/8/3p4/8 b - - 0 1");
     cout << "Before Promote: \n";
     board.printFENBoard();
-    move = Move(51, 59, 6, 0, 0, 10, Move::MoveType::Promote, true, true, true, true); // black pawn d2 promotes to black queen
-    board.makeMove(move);
+    move = Move(51, 59, Move::MoveType::Promote, 4); // black pawn d2 promotes to black queen
+    board.makeMove(move, state);
     cout << "After Promote: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(59) != 10 || board.pieceTypeAtSquare(51) != -1) {
@@ -102,8 +129,8 @@ void unitTest() {
     board.setupPosition("8/8/8/8/8/8/3p4/4Q3 b - - 0 1");
     cout << "Before Promote Capture: \n";
     board.printFENBoard();
-    move = Move(51, 60, 6, 4, 0, 10, Move::MoveType::PromoteCapture, true, true, true, true); // black pawn d2 captures white queen e1 and promotes to black queen
-    board.makeMove(move);
+    move = Move(51, 60, Move::MoveType::PromoteCapture, 4); // black pawn d2 captures white queen e1 and promotes to black queen
+    board.makeMove(move, state);
     cout << "After Promote Capture: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(51) != -1 || board.pieceTypeAtSquare(60) != 10) {
@@ -114,8 +141,8 @@ void unitTest() {
     board.setupPosition("8/8/8/8/8/8/8/4K2R w KQkq - 0 1");
     cout << "Before White Castle King Side: \n";
     board.printFENBoard();
-    move = Move(60, 62, 5, 0, 0, 0, Move::MoveType::CastleKingSide, true, true, true, true); // white king castles king side
-    board.makeMove(move);
+    move = Move(60, 62, Move::MoveType::CastleKingSide); // white king castles king side
+    board.makeMove(move, state);
     cout << "After White Castle King Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(62) != 5 || board.pieceTypeAtSquare(61) != 3 || board.pieceTypeAtSquare(63) != -1 || board.pieceTypeAtSquare(60) != -1) {
@@ -126,8 +153,8 @@ void unitTest() {
     board.setupPosition("8/8/8/8/8/8/8/R3K3 b KQkq - 0 1");
     cout << "Before White Castle Queen Side: \n";
     board.printFENBoard();
-    move = Move(60, 58, 5, 0, 0, 0, Move::MoveType::CastleQueenSide, true, true, true, true); // white king castles queen side
-    board.makeMove(move);
+    move = Move(60, 58, Move::MoveType::CastleQueenSide); // white king castles queen side
+    board.makeMove(move, state);
     cout << "After White Castle Queen Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(58) != 5 || board.pieceTypeAtSquare(59) != 3 || board.pieceTypeAtSquare(56) != -1 || board.pieceTypeAtSquare(57) != -1 || board.pieceTypeAtSquare(60) != -1) {
@@ -138,8 +165,8 @@ void unitTest() {
     board.setupPosition("4k2r/8/8/8/8/8/8/8 b KQkq - 0 1");
     cout << "Before Black Castle King Side: \n";
     board.printFENBoard();
-    move = Move(4, 6, 11, 0, 0, 0, Move::MoveType::CastleKingSide, true, true, true, true); // black king castles king side
-    board.makeMove(move);
+    move = Move(4, 6, Move::MoveType::CastleKingSide); // black king castles king side
+    board.makeMove(move, state);
     cout << "After Black Castle King Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(6) != 11 || board.pieceTypeAtSquare(5) != 9 || board.pieceTypeAtSquare(4) != -1 || board.pieceTypeAtSquare(7) != -1 ) {
@@ -150,26 +177,27 @@ void unitTest() {
     board.setupPosition("r3k3/8/8/8/8/8/8/8 w KQkq - 0 1");
     cout << "Before Black Castle Queen Side: \n";
     board.printFENBoard();
-    move = Move(4, 2, 11, 0, 0, 0, Move::MoveType::CastleQueenSide, true, true, true, true); // black king castles queen side
-    board.makeMove(move);
+    move = Move(4, 2, Move::MoveType::CastleQueenSide); // black king castles queen side
+    board.makeMove(move, state);
     cout << "After Black Castle Queen Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(2) != 11 || board.pieceTypeAtSquare(3) != 9 || board.pieceTypeAtSquare(0) != -1 || board.pieceTypeAtSquare(1) != -1 || board.pieceTypeAtSquare(4) != -1) {
         throw std::invalid_argument("Black Castle Queen Side Test Failed");
     }
 
-    // Move(fromSquare, toSquare, pieceType, capturedPiece, enPassantSquare, promotedPieceType, moveType, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling)
+    // Move(fromSquare, toSquare, moveType, promotedPiece)
     std:: cout << "All MakeMove() Tests Passed!" << std::endl;
 
     std:: cout << " ----------------------------------------------------------------------" << std:: endl;
-    // Testing undoMove()
+    // Testing undoMove(): make each move, undo it and check the board is back where it started
 
     // Normal Move
-    board.setupPosition("8/8/8/8/8/P7/8/8 b - - 0 1");
+    board.setupPosition("8/8/8/8/8/8/P7/8 w - - 0 1");
     std:: cout<< "Before Normal Move: \n";
     board.printFENBoard();
-    move = Move(48, 40, 0, 0, 0, 0, Move::MoveType::Normal, true, true, true, true); // white pawn on a1 moves to a2
-    board.undoMove(move);
+    move = Move(48, 40, Move::MoveType::Normal); // white pawn on a2 moves to a3
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Normal Move: \n";
     board.printFENBoard();
     if (board.pieceTypeAtSquare(48) != 0 || board.pieceTypeAtSquare(40) != -1) {
@@ -177,11 +205,12 @@ void unitTest() {
     }
 
     // Moved Twice
-    board.setupPosition("8/8/8/8/8/P7/8/8 b - - 0 1");
+    board.setupPosition("8/8/8/8/8/8/8/P7 w - - 0 1");
     std:: cout<< "Before Moved Twice: \n";
     board.printFENBoard();
-    move = Move(56, 40, 0, 0, 0, 0, Move::MoveType::MovedTwice, true, true, true, true); // white pawn on a1 moves to a3
-    board.undoMove(move);
+    move = Move(56, 40, Move::MoveType::MovedTwice); // white pawn on a1 moves to a3
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Moved Twice: \n";
     board.printFENBoard();
     if (board.pieceTypeAtSquare(56) != 0 || board.pieceTypeAtSquare(40) != -1) {
@@ -189,12 +218,13 @@ void unitTest() {
     }
 
     // Capture
-    // Move(fromSquare, toSquare, pieceType, capturedPiece, enPassantSquare, promotedPieceType, moveType, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling)
-    board.setupPosition("7R/8/8/8/8/8/8/8 b - - 0 1");
+    // Move(fromSquare, toSquare, moveType, promotedPiece)
+    board.setupPosition("7n/8/8/8/8/8/8/7R w - - 0 1");
     std:: cout<< "Before Capture: \n";
     board.printFENBoard();
-    move = Move(63, 7, 3, 7, 0, 0, Move::MoveType::Capture, true, true, true, true); // white rook on h1 captures black knight at h8
-    board.undoMove(move);
+    move = Move(63, 7, Move::MoveType::Capture); // white rook on h1 captures black knight at h8
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Capture: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(63) != 3 || board.pieceTypeAtSquare(7) != 7) {
@@ -202,11 +232,12 @@ void unitTest() {
     }
 
     // En Passant Capture
-    board.setupPosition("8/8/3P4/8/8/8/8/8 b - - 0 1");
+    board.setupPosition("8/8/8/3pP3/8/8/8/8 w - d6 0 1");
     std:: cout<< "Before En Passant Capture: \n";
     board.printFENBoard();
-    move = Move(28, 19, 0, 6, 19, 0, Move::MoveType::EnPassantCapture, true, true, true, true); //  white pawn e5 captures black pawn on d5
-    board.undoMove(move);
+    move = Move(28, 19, Move::MoveType::EnPassantCapture); //  white pawn e5 captures black pawn on d5
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After En Passant Capture: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(28) != 0 || board.pieceTypeAtSquare(27) != 6 || board.pieceTypeAtSquare(19) != -1) {
@@ -214,11 +245,12 @@ void unitTest() {
     }
 
     // Promote
-    board.setupPosition("8/8/8/8/8/8/8/3q4 w - - 0 1");
+    board.setupPosition("8/8/8/8/8/8/3p4/8 b - - 0 1");
     std:: cout<< "Before Promote: \n";
     board.printFENBoard();
-    move = Move(51, 59, 6, 0, 0, 10, Move::MoveType::Promote, true, true, true, true); // black pawn d2 promotes to black queen
-    board.undoMove(move);
+    move = Move(51, 59, Move::MoveType::Promote, 4); // black pawn d2 promotes to black queen
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Promote: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(51) != 6 || board.pieceTypeAtSquare(60) != -1) {
@@ -226,11 +258,12 @@ void unitTest() {
     }
 
     // Promote Capture
-    board.setupPosition("8/8/8/8/8/8/8/4q3 w - - 0 1");
+    board.setupPosition("8/8/8/8/8/8/3p4/4Q3 b - - 0 1");
     std:: cout<< "Before Promote Capture: \n";
     board.printFENBoard();
-    move = Move(51, 60, 6, 4, 0, 10, Move::MoveType::PromoteCapture, true, true, true, true); // black pawn d2 captures white queen e1 and promotes to black queen
-    board.undoMove(move);
+    move = Move(51, 60, Move::MoveType::PromoteCapture, 4); // black pawn d2 captures white queen e1 and promotes to black queen
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Promote Capture: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(60) != 4 || board.pieceTypeAtSquare(51) != 6) {
@@ -239,11 +272,12 @@ void unitTest() {
 
 
     // White Castle King Side
-    board.setupPosition("8/8/8/8/8/8/8/5RK1 b KQkq - 0 1");
+    board.setupPosition("8/8/8/8/8/8/8/4K2R w KQkq - 0 1");
     std:: cout<< "Before White Castle King Side: \n";
     board.printFENBoard();
-    move = Move(60, 62, 5, 0, 0, 0, Move::MoveType::CastleKingSide, true, true, true, true); // white king castles king side
-    board.undoMove(move);
+    move = Move(60, 62, Move::MoveType::CastleKingSide); // white king castles king side
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After White Castle King Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(60) != 5 || board.pieceTypeAtSquare(63) != 3 || board.pieceTypeAtSquare(61) != -1 || board.pieceTypeAtSquare(62) != -1) {
@@ -251,11 +285,12 @@ void unitTest() {
     }
 
     // White Castle Queen Side
-    board.setupPosition("8/8/8/8/8/8/8/2KR4 b KQkq - 0 1");
+    board.setupPosition("8/8/8/8/8/8/8/R3K3 w KQkq - 0 1");
     std:: cout<< "Before White Castle Queen Side: \n";
     board.printFENBoard();
-    move = Move(60, 58, 5, 0, 0, 0, Move::MoveType::CastleQueenSide, true, true, true, true); // white king castles queen side
-    board.undoMove(move);
+    move = Move(60, 58, Move::MoveType::CastleQueenSide); // white king castles queen side
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After White Castle Queen Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(60) != 5 || board.pieceTypeAtSquare(56) != 3 || board.pieceTypeAtSquare(57) != -1 || board.pieceTypeAtSquare(58) != -1 || board.pieceTypeAtSquare(59) != -1) {
@@ -263,11 +298,12 @@ void unitTest() {
     }
 
     // Black Castle King Side
-    board.setupPosition("5rk1/8/8/8/8/8/8/8 w KQkq - 0 1");
+    board.setupPosition("4k2r/8/8/8/8/8/8/8 b KQkq - 0 1");
     std:: cout<< "Before Black Castle King Side: \n";
     board.printFENBoard();
-    move = Move(4, 6, 11, 0, 0, 0, Move::MoveType::CastleKingSide, true, true, true, true); // black king castles king side
-    board.undoMove(move);
+    move = Move(4, 6, Move::MoveType::CastleKingSide); // black king castles king side
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Black Castle King Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(4) != 11 || board.pieceTypeAtSquare(7) != 9 || board.pieceTypeAtSquare(5) != -1 || board.pieceTypeAtSquare(6) != -1) {
@@ -275,11 +311,12 @@ void unitTest() {
     }
 
     // Black Castle Queen Side
-    board.setupPosition("2kr4/8/8/8/8/8/8/8 w KQkq - 0 1");
+    board.setupPosition("r3k3/8/8/8/8/8/8/8 b KQkq - 0 1");
     std:: cout<< "Before Black Castle Queen Side: \n";
     board.printFENBoard();
-    move = Move(4, 2, 11, 0, 0, 0, Move::MoveType::CastleQueenSide, true, true, true, true); // black king castles queen side
-    board.undoMove(move);
+    move = Move(4, 2, Move::MoveType::CastleQueenSide); // black king castles queen side
+    board.makeMove(move, state);
+    board.undoMove(move, state);
     std:: cout<< "After Black Castle Queen Side: \n";
     board.printFENBoard();
     if(board.pieceTypeAtSquare(4) != 11 || board.pieceTypeAtSquare(0) != 9 || board.pieceTypeAtSquare(1) != -1 || board.pieceTypeAtSquare(2) != -1 || board.pieceTypeAtSquare(3) != -1) {
@@ -348,34 +385,207 @@ void unitTest() {
     if(board.isKingInCheck()) {
         throw std::invalid_argument("White King not in check by blocked queen Test Failed");
     }
-    
+
+    // f3 (45) in the start position is attacked by the pawns on e2 (52) and g2 (54) and the knight on g1 (62)
+    board.setupPosition("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    if (board.attackersTo(45) != ((1ULL << 52) | (1ULL << 54) | (1ULL << 62)) || !board.isSquareAttacked(45, WHITE) || board.isSquareAttacked(45, BLACK)) {
+        throw std::invalid_argument("attackersTo() Test Failed");
+    }
+    // With an empty occupancy the rook on a1 (56) sees through the pawns to a7 (8)
+    if ((board.attackersTo(8) & (1ULL << 56)) || !(board.attackersTo(8, 0) & (1ULL << 56))) {
+        throw std::invalid_argument("attackersTo() Occupancy Test Failed");
+    }
+
     std:: cout << "All isKingInCheck() Tests Passed!" << std::endl;
 
+
+    // Testing Zobrist keys
+
+    std:: cout << " ----------------------------------------------------------------------" << std:: endl;
+
+    // The incremental key has to match a full recompute after every move, and be back where it was after undoing them
+    board.setupPosition("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    uint64_t startKey = board.getHashKey();
+    vector<Move> zobristMoves = board.legalMoveGeneration();
+    for (size_t i = 0; i < zobristMoves.size(); i++) {
+        board.makeMove(zobristMoves[i], state);
+        board.flipColour();
+        if (board.getHashKey() != board.computeHashKey()) {
+            throw std::invalid_argument("Zobrist Key After " + zobristMoves[i].toString() + " Test Failed");
+        }
+        board.flipColour();
+        board.undoMove(zobristMoves[i], state);
+        if (board.getHashKey() != startKey) {
+            throw std::invalid_argument("Zobrist Key After Undoing " + zobristMoves[i].toString() + " Test Failed");
+        }
+    }
+
+    // The same position reached by two different move orders gets the same key
+    board.setupInitialPosition();
+    board.makeMove(Move(62, 45, Move::MoveType::Normal), state); board.flipColour(); // Nf3
+    board.makeMove(Move(1, 18, Move::MoveType::Normal), state); board.flipColour();  // Nc6
+    board.makeMove(Move(57, 42, Move::MoveType::Normal), state); board.flipColour(); // Nc3
+    uint64_t firstOrderKey = board.getHashKey();
+    board.setupInitialPosition();
+    board.makeMove(Move(57, 42, Move::MoveType::Normal), state); board.flipColour(); // Nc3
+    board.makeMove(Move(1, 18, Move::MoveType::Normal), state); board.flipColour();  // Nc6
+    board.makeMove(Move(62, 45, Move::MoveType::Normal), state); board.flipColour(); // Nf3
+    if (board.getHashKey() != firstOrderKey) {
+        throw std::invalid_argument("Zobrist Transposition Test Failed");
+    }
+
+    std:: cout << "All Zobrist Key Tests Passed!" << std::endl;
+
+
+    // Testing the captures / quiets / evasions generators
+
+    std:: cout << " ----------------------------------------------------------------------" << std:: endl;
+
+    MoveList captures, quiets, evasions, allMoves;
+
+    // Kiwipete: 48 legal moves, 8 of them captures, not in check
+    board.setupPosition("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    board.generateCaptures(captures);
+    board.generateQuiets(quiets);
+    board.generateEvasions(evasions);
+    if (captures.size() != 8 || quiets.size() != 40 || !evasions.empty()) {
+        throw std::invalid_argument("Kiwipete Generator Split Test Failed");
+    }
+
+    // A queen promotion is generated with the captures, the under promotions with the quiet moves
+    board.setupPosition("8/P7/8/8/8/8/8/k6K w - - 0 1");
+    board.generateCaptures(captures);
+    board.generateQuiets(quiets);
+    if (captures.size() != 1 || captures[0].getPromotedPiece() != 4 || quiets.size() != 3 + 3) {
+        throw std::invalid_argument("Promotion Generator Split Test Failed");
+    }
+
+    // In check the evasions are every legal move
+    board.setupPosition("k7/8/8/8/8/1p6/2K5/8 w - - 0 1");
+    board.generateEvasions(evasions);
+    board.legalMoveGeneration(allMoves);
+    if (evasions.empty() || evasions.size() != allMoves.size()) {
+        throw std::invalid_argument("Evasions Test Failed");
+    }
+
+    // In double check only the king moves, and its quiet moves still have to come out
+    board.setupPosition("4k3/8/8/8/8/5n2/8/4K2r w - - 0 1");
+    board.legalMoveGeneration(allMoves);
+    if (allMoves.size() != 2) {
+        throw std::invalid_argument("Double Check Test Failed");
+    }
+
+    // bxc6 en passant would leave the king on a5 open to the rook on h5
+    board.setupPosition("8/8/8/KPp4r/8/8/8/7k w - c6 0 1");
+    board.generateCaptures(captures);
+    for (const Move& move : captures) {
+        if (move.getMoveType() == Move::MoveType::EnPassantCapture) {
+            throw std::invalid_argument("En Passant Pin Test Failed");
+        }
+    }
+
+    // The rook on f2 covers f1, so only queen side castling is allowed
+    board.setupPosition("4k3/8/8/8/8/8/5r2/R3K2R w KQ - 0 1");
+    board.generateQuiets(quiets);
+    int castles = 0;
+    for (const Move& move : quiets) {
+        if (move.getMoveType() == Move::MoveType::CastleKingSide) {
+            throw std::invalid_argument("Castling Through Check Test Failed");
+        }
+        if (move.getMoveType() == Move::MoveType::CastleQueenSide) {
+            castles++;
+        }
+    }
+    if (castles != 1) {
+        throw std::invalid_argument("Castling Through Check Test Failed");
+    }
+
+    // Castling rights left in the FEN after the king or the rook has gone from its start square
+    const string staleRights[] = {
+        "4k3/8/8/8/8/8/8/3K3R w K - 0 1",  // the king is on d1
+        "4k3/8/8/8/8/8/8/4K3 w K - 0 1",   // no rook on h1
+        "1r2k3/8/8/8/8/8/8/4K3 b q - 0 1", // the rook is on b8
+    };
+    for (const string& fen : staleRights) {
+        board.setupPosition(fen);
+        board.legalMoveGeneration(allMoves);
+        board.pseudoLegalMoves(quiets);
+        for (const MoveList* list : {&allMoves, &quiets}) {
+            for (const Move& move : *list) {
+                if (move.getMoveType() == Move::MoveType::CastleKingSide || move.getMoveType() == Move::MoveType::CastleQueenSide) {
+                    throw std::invalid_argument("Stale Castling Rights Test Failed");
+                }
+            }
+        }
+    }
+
+    // Queen on b7 guarded by the king is mate, the queen on b6 instead leaves black with no move and no check
+    board.setupPosition("k7/1Q6/1K6/8/8/8/8/8 b - - 0 1");
+    if (board.hasAnyLegalMove() || board.isGameOver() != 1) {
+        throw std::invalid_argument("Checkmate Test Failed");
+    }
+    board.setupPosition("k7/8/1Q6/8/8/8/8/7K b - - 0 1");
+    if (board.hasAnyLegalMove() || board.isGameOver() != 0) {
+        throw std::invalid_argument("Stalemate Test Failed");
+    }
+
+    // givesCheck() against making the move: direct checks, discovered checks by the knight on d6,
+    // a promotion checking along the back rank, and castling with the rook landing on f1
+    board.setupPosition("5k2/P7/3N4/8/8/B7/8/R3K2R w K - 0 1");
+    board.legalMoveGeneration(allMoves);
+    for (const Move& move : allMoves) {
+        bool predicted = board.givesCheck(move);
+        board.makeMove(move, state);
+        board.flipColour();
+        bool check = board.isKingInCheck();
+        board.flipColour();
+        board.undoMove(move, state);
+        if (predicted != check) {
+            throw std::invalid_argument("Gives Check Test Failed");
+        }
+    }
+
+    std:: cout << "All Move Generator Tests Passed!" << std::endl;
+
 }
 
 
-double minimax(Board board, int depth, double alpha, double beta, bool isMaximising, vector<Move>& currentLine ) {
+// Score of a position where the side to move has no legal moves: checkmate or stalemate.
+// The check comes from the board's cached analysis, which finding that there are no moves has already filled in
+double noMovesScore(Board& board, int depth) {
+    // Checkmate scenarios
+    if (board.isKingInCheck()) {
+        if (!board.isWhiteToMove()) {  // White wins by checkmate
+            return 10.0 - (depth * 0.01);  // Favor quicker checkmates
+        } else {  // Black wins by checkmate
+            return -10.0 + (depth * 0.01);  // Favor quicker checkmates
+        }
+    }
+
+    // Stalemate
+    return 0.0;  // Stalemate is a draw
+}
+
+double minimax(Board& board, int depth, double alpha, double beta, bool isMaximising, vector<Move>& currentLine ) {
     nodesSearched++;
 
     if(depth == maxDepth) {
+        // A mate on the last ply would otherwise get a material score. Only looked for in check: the check lookup is
+        // cheap, the analysis hasAnyLegalMove() needs is not, and stalemate at a leaf is rare enough to leave to evaluate()
+        if (board.isKingInCheck() && !board.hasAnyLegalMove()) {
+            return noMovesScore(board, depth);
+        }
         return evaluate(board);
     }
 
-    vector<Move> moves = board.legalMoveGeneration();
-
-    if( moves.empty()) {
-        int terminate = board.isGameOver();
+    // Moves come out of the picker one at a time, so a cutoff skips generating the rest
+    MovePicker picker(board, Move::none(), killerMoves[depth][0], killerMoves[depth][1]);
+    Move move = picker.nextMove();
+    Board::StateInfo state;  // What undoMove() needs to take back the move played at this ply
 
-        // Checkmate or stalemate scenarios
-
-            if (terminate == 1) {  // White wins by checkmate
-                return 10.0 - (depth * 0.01);  // Favor quicker checkmates
-            } else if (terminate == -1) {  // Black wins by checkmate
-                return -10.0 + (depth * 0.01);  // Favor quicker checkmates
-            }            
-
-        // Stalemate
-        return 0.0;  // Stalemate is a draw
+    if( move.isNone()) {
+        // No legal moves, so it is checkmate or stalemate
+        return noMovesScore(board, depth);
     }
 
 
@@ -387,14 +597,14 @@ double minimax(Board board, int depth, double alpha, double beta, bool isMaximis
 
         vector<Move> bestLineAtThisDepth;
 
-        for (int i = 0; i < moves.size(); i++) {
-            board.makeMove(moves[i]);
+        for (; !move.isNone(); move = picker.nextMove()) {
+            board.makeMove(move, state);
             board.flipColour();
-            currentLine.push_back(moves[i]);
+            currentLine.push_back(move);
             vector<Move> newLine;
             double tempValue = minimax(board, depth + 1, alpha, beta, !isMaximising, newLine);
             board.flipColour();
-            board.undoMove(moves[i]);
+            board.undoMove(move, state);
             
 
 
@@ -412,7 +622,7 @@ double minimax(Board board, int depth, double alpha, double beta, bool isMaximis
                     // thirdBestMoveIndex = secondBestMoveIndex;
                     // thirdBestEval = secondBestEval;
                     // secondBestMoveIndex = bestMoveIndex;
-                    bestMoveIndex = i;
+                    bestMove = move;
                     bestMoveEval = bestValue;
                     principalVector = bestLineAtThisDepth;
                 }
@@ -440,6 +650,7 @@ double minimax(Board board, int depth, double alpha, double beta, bool isMaximis
             currentLine.pop_back();
             // Pruning
             if (beta <= alpha) {
+                storeKiller(move, depth);
                 break;
             }
 
@@ -456,15 +667,15 @@ double minimax(Board board, int depth, double alpha, double beta, bool isMaximis
 
         vector<Move> bestLineAtThisDepth;
 
-        for (int i = 0; i < moves.size(); i++) {
-            board.makeMove(moves[i]);
-            currentLine.push_back(moves[i]);
+        for (; !move.isNone(); move = picker.nextMove()) {
+            board.makeMove(move, state);
+            currentLine.push_back(move);
             board.flipColour();
 
             vector<Move> newLine;
             double tempValue = minimax(board, depth + 1, alpha, beta, !isMaximising, newLine);
             board.flipColour();
-            board.undoMove(moves[i]);
+            board.undoMove(move, state);
 
 
             if (tempValue <= leastValue) {
@@ -481,7 +692,7 @@ double minimax(Board board, int depth, double alpha, double beta, bool isMaximis
                 if (depth == 0) {
                     //thirdBestMoveIndex = secondBestMoveIndex;
                     //secondBestMoveIndex = bestMoveIndex;
-                    bestMoveIndex = i;
+                    bestMove = move;
                     bestMoveEval = leastValue;
                     principalVector = bestLineAtThisDepth;
                 }
@@ -505,6 +716,7 @@ double minimax(Board board, int depth, double alpha, double beta, bool isMaximis
 
             // Pruning
             if (beta <= alpha) {
+                storeKiller(move, depth);
                 break;
             }
 
@@ -527,14 +739,191 @@ void printPrincipalVariation() {
     cout << endl;
 }
 
-int main() {
+// Positions for the bench command: openings, middlegames with tactics, endgames and the perft test positions
+const vector<string> benchPositions = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+    "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+    "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+    "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+    "8/8/8/4k3/8/8/8/R3K3 w Q - 0 1",
+};
+
+// Searches every bench position to a fixed depth and prints the total node count, time and nodes per second.
+// The search is deterministic, so the node count is a signature: a change that should only make the engine faster
+// must leave it the same. With a file name the results are also written there as JSON.
+// Returns false if the JSON file could not be written, so a script running bench sees the failure
+bool runBench(int depth, const string& jsonPath) {
+    uint64_t totalNodes = 0;
+    double totalSeconds = 0.0;
+    vector<uint64_t> positionNodes;
+
     Board board;
-    board.precomputeAttackBitboards();
+    Board::precomputeAttackBitboards();
+    maxDepth = depth;
+    for (size_t i = 0; i < benchPositions.size(); i++) {
+        board.setupPosition(benchPositions[i]);
+
+        // Every position starts from the same state, or the killers from the last one would change the node count
+        for (int d = 0; d < MAX_PLY; d++) {
+            killerMoves[d][0] = killerMoves[d][1] = Move::none();
+        }
+        nodesSearched = 0;
+        bestMove = Move::none();
+
+        vector<Move> currentLine;
+        auto start = std::chrono::high_resolution_clock::now();
+        minimax(board, 0, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), board.isWhiteToMove(), currentLine);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> duration = end - start;
+
+        cout << "Position " << i + 1 << "/" << benchPositions.size() << ": " << nodesSearched << " nodes, best move "
+             << (bestMove.isNone() ? "none" : bestMove.toString()) << endl;
+        positionNodes.push_back(nodesSearched);
+        totalNodes += nodesSearched;
+        totalSeconds += duration.count();
+    }
+
+    uint64_t nps = totalSeconds > 0 ? static_cast<uint64_t>(totalNodes / totalSeconds) : 0;
+    cout << "===========================" << endl;
+    cout << "Depth: " << depth << endl;
+    cout << "Total time: " << totalSeconds << " seconds" << endl;
+    cout << "Nodes searched: " << totalNodes << endl;
+    cout << "Nodes/second: " << nps << endl;
+
+    if (!jsonPath.empty()) {
+        ofstream json(jsonPath);
+        if (!json) {
+            cout << "Could not write " << jsonPath << endl;
+            return false;
+        }
+        json << "{\n";
+        json << "  \"depth\": " << depth << ",\n";
+        json << "  \"positions\": " << benchPositions.size() << ",\n";
+        json << "  \"nodes\": " << totalNodes << ",\n";
+        json << "  \"seconds\": " << totalSeconds << ",\n";
+        json << "  \"nps\": " << nps << ",\n";
+        json << "  \"positionNodes\": [";
+        for (size_t i = 0; i < positionNodes.size(); i++) {
+            json << (i ? ", " : "") << positionNodes[i];
+        }
+        json << "]\n";
+        json << "}\n";
+        json.close();
+        if (!json) {
+            cout << "Could not write " << jsonPath << endl;
+            return false;
+        }
+        cout << "Written to " << jsonPath << endl;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Board board;
+    Board::precomputeAttackBitboards();
+    cout << "Slider attacks: " << Board::sliderBackendName() << endl;
+
+    // test: the make/undo, check, Zobrist and move generator tests in unitTest(). A failed test throws
+    if (argc >= 2 && string(argv[1]) == "test") {
+        try {
+            unitTest();
+        } catch (const std::invalid_argument& e) {
+            cout << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // bench [depth] [file.json]: fixed depth search signature, see runBench()
+    if (argc >= 2 && string(argv[1]) == "bench") {
+        int depth = (argc >= 3) ? atoi(argv[2]) : BENCH_DEPTH;
+        if (depth < 1 || depth >= MAX_PLY) {
+            cout << "Depth must be between 1 and " << MAX_PLY - 1 << endl;
+            return 1;
+        }
+        return runBench(depth, (argc >= 4) ? argv[3] : "") ? 0 : 1;
+    }
+
+    // Perft from the command line: the rest of the arguments make up the FEN.
+    // pperft takes the number of threads first if it is given (threadNum otherwise)
+    if (argc >= 3 && (string(argv[1]) == "perft" || string(argv[1]) == "divide" || string(argv[1]) == "hashperft" || string(argv[1]) == "pperft")) {
+        string command = argv[1];
+        int depth = atoi(argv[2]);
+        int fenStart = 3;
+        if (command == "pperft" && argc >= 4 && string(argv[3]).find('/') == string::npos) {
+            threadNum = atoi(argv[3]);
+            fenStart = 4;
+        }
+        string fen;
+        for (int i = fenStart; i < argc; i++) {
+            fen += (i > fenStart ? " " : "") + string(argv[i]);
+        }
+        if (fen.empty()) {
+            fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+        }
+        // The same bound as the search, and far beyond what perft can finish
+        if (depth < 1 || depth >= MAX_PLY) {
+            cout << "Depth must be between 1 and " << MAX_PLY - 1 << endl;
+            return 1;
+        }
+        board.setupPosition(fen);
+        if (command == "perft") {
+            runPerft(board, depth);
+        } else if (command == "hashperft") {
+            runHashPerft(board, depth, PERFT_TABLE_MEGABYTES);
+        } else if (command == "pperft") {
+            runParallelPerft(board, depth, threadNum);
+        } else {
+            runDivide(board, depth);
+        }
+        return 0;
+    }
+
     cout << "Enter FEN Notation / Empty For Default Position: \n";
     string fen;
     getline(cin, fen); // input from terminal
     cout << "Enter Max Depth: \n";
     cin >> maxDepth;
+    // The killer moves are kept per ply, for plies below MAX_PLY
+    if (!cin || maxDepth < 1 || maxDepth >= MAX_PLY) {
+        cout << "Depth must be between 1 and " << MAX_PLY - 1 << endl;
+        return 1;
+    }
     principalVector.resize(maxDepth);
     if(fen.empty()) {
         fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";   
@@ -570,18 +959,17 @@ int main() {
         board.printFENBoard();
 
         cout << "Nodes Searched: " << nodesSearched << " in " << duration.count() << " seconds" << endl;
-        if(bestMoveIndex == -1) {
+        if(bestMove.isNone()) {
             cout << "No Best Move Found" << endl;
         } else {
             cout << "------------------" << endl;
-            cout << moves[bestMoveIndex].toString() << " " << bestMoveEval << endl;
+            cout << bestMove.toString() << " " << bestMoveEval << endl;
             //cout << moves[secondBestMoveIndex].toString() << " " << secondBestEval << endl;
             //cout << moves[thirdBestMoveIndex].toString() << " " << thirdBestEval << endl;
             cout << "------------------" << endl;
         }
 
         printPrincipalVariation();
-        //unitTest();
     } else {
         vector<Move> moves = board.legalMoveGeneration();
         cout << "Number of Moves: " << moves.size() << endl;
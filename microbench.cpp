@@ -0,0 +1,213 @@
+// Component micro benchmarks: times each hot part of the engine on its own over a fixed set of positions,
+// so a change shows up in the part it touched instead of only in the total search speed.
+// Every benchmark is run many times and the median and the 99th percentile of the ns per operation are printed,
+// the median for comparing builds and the p99 to spot noise.
+//
+// Has its own main(), so it is built on its own:
+// g++ -std=c++11 -O2 -pthread -o microbench.out microbench.cpp board.cpp move.cpp evaluation.cpp
+// ./microbench.out
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include "board.h"
+#include "move.h"
+#include "evaluation.h"
+
+using namespace std;
+
+// Opening, middlegame and endgame positions, including the standard perft test positions
+const vector<string> corpus = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+    "2r3k1/pp3ppp/4p3/3p4/3P4/2P1PN2/PP3PPP/2R3K1 b - - 0 20",
+    "8/5pk1/6p1/7p/7P/6P1/5PK1/8 w - - 0 40",
+    "6k1/5ppp/8/8/8/8/1Q3PPP/6K1 b - - 0 30",
+};
+
+const int RUNS = 101;   // timed runs of every benchmark
+const int WARMUP = 5;   // untimed runs first, to fill the caches
+
+// Stops the compiler from removing work whose result is never used
+volatile uint64_t sink = 0;
+
+// Runs one pass over the corpus RUNS times and prints the median and p99 ns per operation.
+// pass() does the work and returns how many operations it did
+void bench(const string& name, const function<long long()>& pass) {
+    for (int i = 0; i < WARMUP; i++) {
+        pass();
+    }
+
+    vector<double> nsPerOp;
+    for (int i = 0; i < RUNS; i++) {
+        auto start = chrono::high_resolution_clock::now();
+        long long ops = pass();
+        auto end = chrono::high_resolution_clock::now();
+        double ns = chrono::duration<double, nano>(end - start).count();
+        nsPerOp.push_back(ns / ops);
+    }
+
+    sort(nsPerOp.begin(), nsPerOp.end());
+    double median = nsPerOp[nsPerOp.size() / 2];
+    double p99 = nsPerOp[(nsPerOp.size() * 99) / 100];
+    cout << left << setw(28) << name << right << fixed << setprecision(2)
+         << setw(10) << median << " ns/op median" << setw(10) << p99 << " ns/op p99" << endl;
+}
+
+int main() {
+    Board::precomputeAttackBitboards();
+    cout << "Slider attacks: " << Board::sliderBackendName() << endl;
+    cout << corpus.size() << " positions, " << RUNS << " runs per benchmark" << endl;
+    cout << "sizeof(Board): " << sizeof(Board) << " bytes" << endl << endl;
+
+    // One board per position, set up once so the setup is never timed. Each gets a root StateInfo to keep its
+    // analysis in, like a position the search reached by a move
+    vector<Board> boards(corpus.size());
+    vector<Board::StateInfo> rootStates(corpus.size());
+    for (size_t i = 0; i < corpus.size(); i++) {
+        boards[i].setupPosition(corpus[i], &rootStates[i]);
+    }
+
+    bench("generateBishopAttacks", [&]() {
+        long long ops = 0;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (Board& b : boards) {
+                for (int square = 0; square < 64; square++) {
+                    sink ^= b.generateBishopAttacks(square, b.occupied);
+                    ops++;
+                }
+            }
+        }
+        return ops;
+    });
+
+    bench("generateRookAttacks", [&]() {
+        long long ops = 0;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (Board& b : boards) {
+                for (int square = 0; square < 64; square++) {
+                    sink ^= b.generateRookAttacks(square, b.occupied);
+                    ops++;
+                }
+            }
+        }
+        return ops;
+    });
+
+    // Before any moves are generated, so this is the attack lookup and not the answer cached by the generator
+    bench("isKingInCheck", [&]() {
+        long long ops = 0;
+        for (int repeat = 0; repeat < 100; repeat++) {
+            for (Board& b : boards) {
+                sink ^= b.isKingInCheck();
+                ops++;
+            }
+        }
+        return ops;
+    });
+
+    // Flipping the side twice drops the board's cached check and pin analysis, so every generation does it again
+    bench("legalMoveGeneration", [&]() {
+        long long ops = 0;
+        MoveList moves;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (Board& b : boards) {
+                b.flipColour();
+                b.flipColour();
+                b.legalMoveGeneration(moves);
+                sink ^= moves.size();
+                ops++;
+            }
+        }
+        return ops;
+    });
+
+    bench("countLegalMoves", [&]() {
+        long long ops = 0;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (Board& b : boards) {
+                b.flipColour();
+                b.flipColour();
+                sink ^= b.countLegalMoves();
+                ops++;
+            }
+        }
+        return ops;
+    });
+
+    // Every legal move of every position made and undone
+    vector<MoveList> legalMoves(boards.size());
+    for (size_t i = 0; i < boards.size(); i++) {
+        boards[i].legalMoveGeneration(legalMoves[i]);
+    }
+    bench("makeMove + undoMove", [&]() {
+        long long ops = 0;
+        Board::StateInfo state;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (size_t i = 0; i < boards.size(); i++) {
+                for (const Move& move : legalMoves[i]) {
+                    boards[i].makeMove(move, state);
+                    boards[i].undoMove(move, state);
+                    ops++;
+                }
+                sink ^= boards[i].getHashKey();
+            }
+        }
+        return ops;
+    });
+
+    // Against the make + isKingInCheck + undo it saves. The check squares are worked out once per position and kept
+    bench("givesCheck", [&]() {
+        long long ops = 0;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (size_t i = 0; i < boards.size(); i++) {
+                for (const Move& move : legalMoves[i]) {
+                    sink ^= boards[i].givesCheck(move);
+                    ops++;
+                }
+            }
+        }
+        return ops;
+    });
+
+    // The same moves played by copying the board and making the move on the copy, with nothing to undo.
+    // How this compares with make + undo depends mostly on sizeof(Board)
+    bench("copy + makeMove", [&]() {
+        long long ops = 0;
+        Board::StateInfo state;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (size_t i = 0; i < boards.size(); i++) {
+                for (const Move& move : legalMoves[i]) {
+                    Board copy = boards[i];
+                    copy.makeMove(move, state);
+                    sink ^= copy.getHashKey();
+                    ops++;
+                }
+            }
+        }
+        return ops;
+    });
+
+    bench("evaluate", [&]() {
+        long long ops = 0;
+        for (int repeat = 0; repeat < 20; repeat++) {
+            for (Board& b : boards) {
+                sink ^= static_cast<uint64_t>(evaluate(b) * 1000000);
+                ops++;
+            }
+        }
+        return ops;
+    });
+
+    return 0;
+}
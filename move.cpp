@@ -1,11 +1,12 @@
 #include "move.h"
 #include <iostream>
 #include <string>
+#include <stdexcept>
 
 using namespace std;
 
 std::string Move::moveTypeToString() const {
-    switch (moveType) {
+    switch (getMoveType()) {
         case MoveType::Normal: return "Normal";
         case MoveType::MovedTwice: return "Moved Twice";
         case MoveType::Capture: return "Capture";
@@ -21,36 +22,18 @@ std::string Move::moveTypeToString() const {
 
 // debugging
 void Move::display() const {
-    string pieces[] = {
-        "White Pawn", "White Knight","White Bishop", "White Rook", "White Queen", "White King",
-        "Black Pawn", "Black Knight", "Black Bishop", "Black Rook", "Black Queen", "Black King"
-    };
-    cout << pieces[pieceType] << " moves from Square: " << bitboardIndexToCoordinate(fromSquare) << " to Square: " << bitboardIndexToCoordinate(toSquare) << " (" << moveTypeToString() << ")" << endl;
-    cout << "capturedPieceType: " << capturedPieceType << endl;
-    cout << "enPassantSquare: " << enPassantSquare << endl;
-    cout << "promotedPieceType: " << promotedPieceType << endl;
-    cout << "whiteKingSideCastling: " << whiteKingSideCastling << endl;
-    cout << "whiteQueenSideCastling: " << whiteQueenSideCastling << endl;
-    cout << "blackKingSideCastling: " << blackKingSideCastling << endl;
-    cout << "blackQueenSideCastling: " << blackQueenSideCastling << endl;
+    string pieces[] = { "", "Knight", "Bishop", "Rook", "Queen" };
+    cout << "Move from Square: " << bitboardIndexToCoordinate(getFromSquare()) << " to Square: " << bitboardIndexToCoordinate(getToSquare()) << " (" << moveTypeToString() << ")" << endl;
+    cout << "promotedPiece: " << pieces[getPromotedPiece()] << endl;
+    cout << "raw: " << getData() << endl;
 }
 
-// for displaying to user
+// for displaying to user, in coordinate notation (e2e4, e7e8q)
 std::string Move::toString() const {
-    string pieces[] = {
-        "White Pawn", "White Knight", "White Bishop", "White Rook", "White Queen", "White King",
-        "Black Pawn", "Black Knight", "Black Bishop", "Black Rook", "Black Queen", "Black King"
-    };
+    string result = bitboardIndexToCoordinate(getFromSquare()) + bitboardIndexToCoordinate(getToSquare());
 
-    string result = pieces[pieceType] + " moves from Square: " + bitboardIndexToCoordinate(fromSquare) +
-                    " to Square: " + bitboardIndexToCoordinate(toSquare) + " (" + moveTypeToString() + ")";
-
-    if (moveType == MoveType::Capture || moveType == MoveType::PromoteCapture) {
-        result += " and captures " + pieces[capturedPieceType];
-    }
-
-    if (moveType == MoveType::Promote || moveType == MoveType::PromoteCapture) {
-        result += " and promotes to " + pieces[promotedPieceType];
+    if (isPromotion()) {
+        result += "nbrq"[getPromotedPiece() - 1];
     }
 
     return result;
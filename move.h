@@ -1,9 +1,14 @@
 #ifndef MOVE_H
 #define MOVE_H
 
+#include <cstdint>
 #include <string>
-#include <vector>
 
+// A move is packed into 16 bits:
+//   bits 0-5    fromSquare
+//   bits 6-11   toSquare
+//   bits 12-15  flag: the move type, plus the promotion piece for promotions
+// The moving piece, the captured piece and everything needed to undo the move are tracked by the Board
 class Move {
     public:
 
@@ -20,32 +25,26 @@ class Move {
 
     std::string moveTypeToString() const;  // Function to convert MoveType to string
     // Move constructor:
-    // Move(fromSquare, toSquare, pieceType, capturedPiece, enPassantSquare, promotedPieceType, moveType, whiteKingSideCastling, whiteQueenSideCastling, blackKingSideCastling, blackQueenSideCastling)
-
-
-    Move() {
-        fromSquare = -1;
-        toSquare = -1;
-        pieceType = -1;
-        moveType = MoveType::Normal;
-        capturedPieceType = -1;
-        enPassantSquare = -1;
-        promotedPieceType = -1;
-        whiteKingSideCastling = false;
-        whiteQueenSideCastling = false;
-        blackKingSideCastling = false;
-        blackQueenSideCastling = false;
-    }
-
-    Move(int fromSquare, int toSquare, int pieceType, int capturedPieceType = -1, int enPassantSquare = -1, int promotedPieceType = -1,
-         MoveType moveType = MoveType::Normal, bool whiteKingSideCastling = false, bool whiteQueenSideCastling = false, 
-         bool blackKingSideCastling = false, bool blackQueenSideCastling = false):
-            fromSquare(fromSquare), toSquare(toSquare), pieceType(pieceType), moveType(moveType),
-            capturedPieceType(capturedPieceType), enPassantSquare(enPassantSquare), promotedPieceType(promotedPieceType),
-            whiteKingSideCastling(whiteKingSideCastling), whiteQueenSideCastling(whiteQueenSideCastling),
-            blackKingSideCastling(blackKingSideCastling), blackQueenSideCastling(blackQueenSideCastling) {
-
-                assert(pieceType >= 0 && pieceType < 12);
+    // Move(fromSquare, toSquare, moveType, promotedPiece)
+    // promotedPiece is 1 = knight, 2 = bishop, 3 = rook, 4 = queen, added to the mover's first piece index by the board
+
+
+    // Left uninitialised so a MoveList's buffer costs nothing to create; Move() value-initialises to 0
+    Move() = default;
+
+    Move(int fromSquare, int toSquare, MoveType moveType = MoveType::Normal, int promotedPiece = 0) {
+        int flag = 0;
+        switch (moveType) {
+            case MoveType::Normal:           flag = 0; break;
+            case MoveType::MovedTwice:       flag = 1; break;
+            case MoveType::CastleKingSide:   flag = 2; break;
+            case MoveType::CastleQueenSide:  flag = 3; break;
+            case MoveType::Capture:          flag = 4; break;
+            case MoveType::EnPassantCapture: flag = 5; break;
+            case MoveType::Promote:          flag = 8 + (promotedPiece - 1); break;
+            case MoveType::PromoteCapture:   flag = 12 + (promotedPiece - 1); break;
+        }
+        data = uint16_t(fromSquare | (toSquare << 6) | (flag << 12));
     }
 
     void display() const;
@@ -57,64 +56,113 @@ class Move {
 
     // getters
     int getFromSquare() const {
-        return fromSquare;
+        return data & 0x3F;
     }
 
     int getToSquare() const {
-        return toSquare;
+        return (data >> 6) & 0x3F;
     }
 
-    int getPieceType() const {
-        return pieceType;
+    MoveType getMoveType() const {
+        switch (getFlag()) {
+            case 0: return MoveType::Normal;
+            case 1: return MoveType::MovedTwice;
+            case 2: return MoveType::CastleKingSide;
+            case 3: return MoveType::CastleQueenSide;
+            case 4: return MoveType::Capture;
+            case 5: return MoveType::EnPassantCapture;
+            default: return isCapture() ? MoveType::PromoteCapture : MoveType::Promote;
+        }
     }
 
-    MoveType getMoveType() const {
-        return moveType;
+    // 1 = knight ... 4 = queen, 0 if the move is not a promotion
+    int getPromotedPiece() const {
+        return isPromotion() ? (getFlag() & 3) + 1 : 0;
+    }
+
+    int getFlag() const {
+        return data >> 12;
+    }
+
+    bool isCapture() const {
+        return (getFlag() & 4) != 0; // Capture, EnPassantCapture and PromoteCapture
+    }
+
+    bool isPromotion() const {
+        return (getFlag() & 8) != 0;
+    }
+
+    uint16_t getData() const {
+        return data;
+    }
+
+    // a8 to a8 can never be a real move, so it stands for "no move"
+    static Move none() {
+        return Move(0, 0);
+    }
+
+    bool isNone() const {
+        return data == 0;
+    }
+
+    bool operator==(const Move& other) const {
+        return data == other.data;
+    }
+
+    bool operator!=(const Move& other) const {
+        return data != other.data;
     }
 
-    int getCapturedPieceType() const {
-        return capturedPieceType;
+    private:
+        uint16_t data;
+};
+
+
+// Fixed capacity list of moves that lives on the stack, so generating moves never touches the heap.
+// No legal chess position has more than 218 moves, 256 leaves room for the pseudo legal generator
+class MoveList {
+    public:
+
+    static const int MAX_MOVES = 256;
+
+    MoveList() : count(0) {}
+
+    void push_back(const Move& move) {
+        moves[count++] = move;
     }
 
-    int getEnPassantSquare() const {
-        return enPassantSquare;
+    void clear() {
+        count = 0;
     }
 
-    int getPromotedPieceType() const {
-        return promotedPieceType;
+    void resize(int newSize) {
+        count = newSize;
     }
 
-    bool getWhiteKingSideCastling() const {
-        return whiteKingSideCastling;
+    int size() const {
+        return count;
     }
 
-    bool getWhiteQueenSideCastling() const {
-        return whiteQueenSideCastling;
+    bool empty() const {
+        return count == 0;
     }
 
-    bool getBlackKingSideCastling() const {
-        return blackKingSideCastling;
+    Move& operator[](int index) {
+        return moves[index];
     }
 
-    bool getBlackQueenSideCastling() const {
-        return blackQueenSideCastling;
+    const Move& operator[](int index) const {
+        return moves[index];
     }
 
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+    const Move* begin() const { return moves; }
+    const Move* end() const { return moves + count; }
+
     private:
-        // The current move
-        int fromSquare;
-        int toSquare;
-        int pieceType;
-        MoveType moveType;
-        int capturedPieceType; // optional
-        int enPassantSquare; // optional
-        int promotedPieceType; // optional
-
-        // Previous board state to undo the move
-        bool whiteKingSideCastling;
-        bool whiteQueenSideCastling;
-        bool blackKingSideCastling;
-        bool blackQueenSideCastling;
+        Move moves[MAX_MOVES];
+        int count;
 };
 
-#endif // MOVE_H
\ No newline at end of file
+#endif // MOVE_H
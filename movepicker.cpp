@@ -0,0 +1,140 @@
+#include "movepicker.h"
+
+// Piece values for ordering only, indexed by piece type % 6.
+// The king is worth nothing as an attacker: a legal king capture can never be taken back
+static const int captureValues[6] = { 1, 3, 3, 5, 9, 0 };
+
+MovePicker::MovePicker(Board& board, Move hashMove, Move killer1, Move killer2)
+    : board(board), hashMove(hashMove), stage(HASH_MOVE), captureIndex(0), capturesGenerated(false),
+      badCaptureIndex(0), quietIndex(0), killerIndex(0), quietsGenerated(false) {
+    killers[0] = killer1;
+    killers[1] = (killer2 == killer1) ? Move::none() : killer2;
+}
+
+void MovePicker::generateCaptures() {
+    board.generateMoves(captures, Board::CAPTURES);
+    capturesGenerated = true;
+
+    // Most valuable victim first, least valuable attacker to break ties. A queen promotion gains a queen for a pawn
+    for (int i = 0; i < captures.size(); i++) {
+        const Move& move = captures[i];
+        int attacker = captureValues[board.pieceTypeAtSquare(move.getFromSquare()) % 6];
+        int victim = 0;
+        if (move.getMoveType() == Move::MoveType::EnPassantCapture) {
+            victim = captureValues[0];
+        } else if (move.isCapture()) {
+            victim = captureValues[board.pieceTypeAtSquare(move.getToSquare()) % 6];
+        }
+        if (move.getPromotedPiece() == 4) {
+            victim += captureValues[4] - captureValues[0];
+        }
+        // Scores below zero mark the bad captures
+        captureScores[i] = (victim >= attacker) ? victim * 16 - attacker : victim - attacker;
+    }
+}
+
+void MovePicker::generateQuiets() {
+    board.generateMoves(quiets, Board::QUIETS);
+    quietsGenerated = true;
+}
+
+bool MovePicker::contains(const MoveList& moves, const Move& move) {
+    for (int i = 0; i < moves.size(); i++) {
+        if (moves[i] == move) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MovePicker::isKiller(const Move& move) const {
+    return move == killers[0] || move == killers[1];
+}
+
+Move MovePicker::nextMove() {
+    while (true) {
+        switch (stage) {
+            case HASH_MOVE:
+                stage = GOOD_CAPTURES;
+                if (!hashMove.isNone()) {
+                    // Split the way the generators split: under promotions go with the quiets even when they capture
+                    bool noisy = hashMove.isPromotion() ? hashMove.getPromotedPiece() == 4 : hashMove.isCapture();
+                    if (noisy) {
+                        generateCaptures();
+                        if (contains(captures, hashMove)) return hashMove;
+                    } else if (hashMove.isCapture()) {
+                        // An under promotion capture, which Board::isLegalQuiet() turns down
+                        generateQuiets();
+                        if (contains(quiets, hashMove)) return hashMove;
+                    } else if (board.isLegalQuiet(hashMove)) {
+                        return hashMove;
+                    }
+                    hashMove = Move::none();
+                }
+                break;
+
+            case GOOD_CAPTURES:
+                if (!capturesGenerated) {
+                    generateCaptures();
+                }
+                while (captureIndex < captures.size()) {
+                    // Selection sort one move at a time, at a cut node most of the list is never sorted
+                    int best = captureIndex;
+                    for (int i = captureIndex + 1; i < captures.size(); i++) {
+                        if (captureScores[i] > captureScores[best]) best = i;
+                    }
+                    Move move = captures[best];
+                    int score = captureScores[best];
+                    captures[best] = captures[captureIndex];
+                    captureScores[best] = captureScores[captureIndex];
+                    captureIndex++;
+
+                    if (move == hashMove) continue;
+                    if (score < 0) {
+                        badCaptures.push_back(move);
+                        continue;
+                    }
+                    return move;
+                }
+                stage = KILLERS;
+                break;
+
+            case KILLERS:
+                // The killers are quiet moves from elsewhere in the tree, checked one by one so a cutoff from a
+                // killer still never generates the quiet moves
+                while (killerIndex < 2) {
+                    Move killer = killers[killerIndex++];
+                    if (!killer.isNone() && killer != hashMove && board.isLegalQuiet(killer)) {
+                        return killer;
+                    }
+                    // Illegal in this position (or already played as the hash move), so the quiet stage has nothing to skip for it
+                    killers[killerIndex - 1] = Move::none();
+                }
+                stage = QUIETS;
+                break;
+
+            case QUIETS:
+                if (!quietsGenerated) {
+                    generateQuiets();
+                }
+                while (quietIndex < quiets.size()) {
+                    Move move = quiets[quietIndex++];
+                    if (move == hashMove || isKiller(move)) continue;
+                    return move;
+                }
+                stage = BAD_CAPTURES;
+                break;
+
+            case BAD_CAPTURES:
+                if (badCaptureIndex < badCaptures.size()) {
+                    return badCaptures[badCaptureIndex++];
+                }
+                stage = DONE;
+                break;
+
+            case DONE:
+            default:
+                return Move::none();
+        }
+    }
+}
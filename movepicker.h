@@ -0,0 +1,64 @@
+#ifndef MOVEPICKER_H
+#define MOVEPICKER_H
+
+#include "board.h"
+#include "move.h"
+
+// Hands out the legal moves of a position one at a time, best guesses first, and only generates a group of
+// moves once the search asks for more than the groups before it could give.
+// If a cutoff comes from the hash move, a good capture or a killer, the quiet moves are never generated at all.
+//
+// Order:
+//  1) hash move        (from the caller, if it is legal here)
+//  2) good captures    (most valuable victim / least valuable attacker, not losing material on paper)
+//  3) killer moves     (quiet moves that caused a cutoff at the same depth elsewhere in the tree)
+//  4) quiet moves
+//  5) bad captures     (a more valuable piece taking a less valuable one)
+//
+// The hash move and the killers can come from a different position, so they are only played if they are legal here:
+// a noisy hash move has to turn up in the generated captures, an under promotion capture in the generated quiets,
+// and any other quiet one or a killer passes Board::isLegalQuiet().
+class MovePicker {
+    public:
+
+    MovePicker(Board& board, Move hashMove = Move::none(), Move killer1 = Move::none(), Move killer2 = Move::none());
+
+    // Move::none() once every legal move has been handed out
+    Move nextMove();
+
+    private:
+
+    enum Stage {
+        HASH_MOVE,
+        GOOD_CAPTURES,
+        KILLERS,
+        QUIETS,
+        BAD_CAPTURES,
+        DONE
+    };
+
+    Board& board;
+    Move hashMove;
+    Move killers[2];
+    int stage;
+
+    MoveList captures;
+    int captureScores[MoveList::MAX_MOVES];
+    int captureIndex;
+    bool capturesGenerated;
+
+    MoveList badCaptures;
+    int badCaptureIndex;
+
+    MoveList quiets;
+    int quietIndex;
+    int killerIndex;
+    bool quietsGenerated;
+
+    void generateCaptures();
+    void generateQuiets();
+    static bool contains(const MoveList& moves, const Move& move);
+    bool isKiller(const Move& move) const;
+};
+
+#endif // MOVEPICKER_H
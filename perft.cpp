@@ -0,0 +1,225 @@
+#include "perft.h"
+#include "move.h"
+
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+
+uint64_t perft(Board& board, int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+
+    // Bulk counting: the generator is fully legal, so every move at the last ply is a leaf and only their number is needed
+    if (depth == 1) {
+        return board.countLegalMoves();
+    }
+
+    MoveList moves;
+    board.legalMoveGeneration(moves);
+
+    uint64_t nodes = 0;
+    Board::StateInfo state;
+    for (int i = 0; i < moves.size(); i++) {
+        board.makeMove(moves[i], state);
+        board.flipColour();
+        nodes += perft(board, depth - 1);
+        board.flipColour();
+        board.undoMove(moves[i], state);
+    }
+    return nodes;
+}
+
+PerftTable::PerftTable(size_t megabytes) {
+    // Round down to a power of two so the slot is the low bits of the key
+    size_t count = 1;
+    while (count * 2 * sizeof(Entry) <= megabytes * 1024 * 1024) {
+        count *= 2;
+    }
+    entries.assign(count, Entry{0, 0});
+    indexMask = count - 1;
+}
+
+bool PerftTable::probe(uint64_t key, int depth, uint64_t& nodes) const {
+    const Entry* bucket = &entries[key & indexMask & ~1ULL];
+    for (int i = 0; i < 2; i++) {
+        if (bucket[i].key == key && static_cast<int>(bucket[i].nodesAndDepth & 0xFF) == depth) {
+            nodes = bucket[i].nodesAndDepth >> 8;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerftTable::store(uint64_t key, int depth, uint64_t nodes) {
+    Entry* bucket = &entries[key & indexMask & ~1ULL];
+    // The first slot keeps the deepest count, a big subtree is worth more than a small one.
+    // Everything else goes in the second slot
+    Entry& entry = (depth >= static_cast<int>(bucket[0].nodesAndDepth & 0xFF)) ? bucket[0] : bucket[1];
+    entry.key = key;
+    entry.nodesAndDepth = (nodes << 8) | static_cast<uint64_t>(depth);
+}
+
+uint64_t perft(Board& board, int depth, PerftTable& table) {
+    // Depth 1 is a single bulk counted generation, cheaper than a table lookup that misses
+    if (depth <= 1) {
+        return perft(board, depth);
+    }
+
+    uint64_t nodes = 0;
+    if (table.probe(board.getHashKey(), depth, nodes)) {
+        return nodes;
+    }
+
+    MoveList moves;
+    board.legalMoveGeneration(moves);
+    Board::StateInfo state;
+    for (int i = 0; i < moves.size(); i++) {
+        board.makeMove(moves[i], state);
+        board.flipColour();
+        nodes += perft(board, depth - 1, table);
+        board.flipColour();
+        board.undoMove(moves[i], state);
+    }
+
+    table.store(board.getHashKey(), depth, nodes);
+    return nodes;
+}
+
+static void printSummary(uint64_t nodes, double seconds) {
+    std::cout << "Nodes: " << nodes << std::endl;
+    std::cout << "Time: " << seconds << " seconds" << std::endl;
+    if (seconds > 0) {
+        std::cout << "NPS: " << static_cast<uint64_t>(nodes / seconds) << std::endl;
+    }
+}
+
+void runPerft(Board& board, int depth) {
+    auto start = std::chrono::high_resolution_clock::now();
+    uint64_t nodes = perft(board, depth);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end - start;
+
+    printSummary(nodes, duration.count());
+}
+
+void runDivide(Board& board, int depth) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MoveList moves;
+    board.legalMoveGeneration(moves);
+
+    uint64_t nodes = 0;
+    Board::StateInfo state;
+    for (int i = 0; i < moves.size(); i++) {
+        uint64_t moveNodes = 1;
+        if (depth > 1) {
+            board.makeMove(moves[i], state);
+            board.flipColour();
+            moveNodes = perft(board, depth - 1);
+            board.flipColour();
+            board.undoMove(moves[i], state);
+        }
+        std::cout << moves[i].toString() << ": " << moveNodes << std::endl;
+        nodes += moveNodes;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end - start;
+
+    std::cout << std::endl << "Moves: " << moves.size() << std::endl;
+    printSummary(nodes, duration.count());
+}
+
+void runHashPerft(Board& board, int depth, size_t megabytes) {
+    auto start = std::chrono::high_resolution_clock::now();
+    PerftTable table(megabytes);
+    uint64_t nodes = perft(board, depth, table);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end - start;
+
+    printSummary(nodes, duration.count());
+}
+
+// The moves from the root to one work item of runParallelPerft()
+struct PerftWorkItem {
+    Move moves[2];
+    int length;
+};
+
+void runParallelPerft(const Board& board, int depth, int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Split the tree at the root, or one ply further down when there is enough depth for it, so there are
+    // many more items than threads and the big subtrees don't all end up on one thread
+    std::vector<PerftWorkItem> items;
+    Board root = board;
+    MoveList rootMoves;
+    root.legalMoveGeneration(rootMoves);
+    for (int i = 0; i < rootMoves.size(); i++) {
+        if (depth < 3) {
+            items.push_back(PerftWorkItem{{rootMoves[i], Move::none()}, 1});
+            continue;
+        }
+        Board child = root;
+        Board::StateInfo state;
+        child.makeMove(rootMoves[i], state);
+        child.flipColour();
+        MoveList replies;
+        child.legalMoveGeneration(replies);
+        for (int j = 0; j < replies.size(); j++) {
+            items.push_back(PerftWorkItem{{rootMoves[i], replies[j]}, 2});
+        }
+    }
+
+    std::atomic<int> nextItem(0);
+    std::vector<uint64_t> threadNodes(threads, 0);
+    std::vector<double> threadSeconds(threads, 0.0);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            auto threadStart = std::chrono::high_resolution_clock::now();
+            uint64_t nodes = 0;
+            int index;
+            while ((index = nextItem.fetch_add(1)) < static_cast<int>(items.size())) {
+                // Copy-make: every item starts from its own copy of the root, so nothing has to be undone
+                const PerftWorkItem& item = items[index];
+                Board local = board;
+                Board::StateInfo states[2];
+                for (int i = 0; i < item.length; i++) {
+                    local.makeMove(item.moves[i], states[i]);
+                    local.flipColour();
+                }
+                nodes += perft(local, depth - item.length);
+            }
+            std::chrono::duration<double> threadDuration = std::chrono::high_resolution_clock::now() - threadStart;
+            threadNodes[t] = nodes;
+            threadSeconds[t] = threadDuration.count();
+        }));
+    }
+
+    uint64_t nodes = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+        nodes += threadNodes[t];
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end - start;
+
+    std::cout << "Work items: " << items.size() << std::endl;
+    for (int t = 0; t < threads; t++) {
+        std::cout << "Thread " << t << ": " << threadNodes[t] << " nodes in " << threadSeconds[t] << " seconds";
+        if (threadSeconds[t] > 0) {
+            std::cout << " (" << static_cast<uint64_t>(threadNodes[t] / threadSeconds[t]) << " NPS)";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "Threads: " << threads << std::endl;
+    printSummary(nodes, duration.count());
+}
@@ -0,0 +1,56 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "board.h"
+
+// Perft: the number of leaf nodes of the legal move tree to a fixed depth. The counts for well known positions
+// are published, so any difference points at a move generation bug, and the time taken is the speed of the move
+// generator on its own, without the search and evaluation on top of it.
+// https://www.chessprogramming.org/Perft_Results
+
+// Leaf nodes below the board's position. At depth 1 the moves are counted without being made
+uint64_t perft(Board& board, int depth);
+
+// perft <depth>: prints the node count, the time taken and the nodes per second
+void runPerft(Board& board, int depth);
+
+// divide <depth>: the same, with the count below every root move first, to find which move a wrong total comes from
+void runDivide(Board& board, int depth);
+
+// Subtree counts cached by (Zobrist key, depth), so a position reached by different move orders is only counted
+// once. Fixed size, in buckets of two entries: the first keeps the deepest count stored in the bucket so far, the
+// second takes everything shallower, replacing whatever was there
+class PerftTable {
+    public:
+
+    explicit PerftTable(size_t megabytes);
+
+    bool probe(uint64_t key, int depth, uint64_t& nodes) const;
+    void store(uint64_t key, int depth, uint64_t nodes);
+
+    private:
+
+    // The node count and the depth share one word: the low 8 bits are the depth
+    struct Entry {
+        uint64_t key;
+        uint64_t nodesAndDepth;
+    };
+    std::vector<Entry> entries;
+    uint64_t indexMask; // the number of entries is a power of two
+};
+
+// perft() with the table, for the deep counts that would take minutes without it
+uint64_t perft(Board& board, int depth, PerftTable& table);
+
+// hashperft <depth>: runPerft() with a table of the given size
+void runHashPerft(Board& board, int depth, size_t megabytes);
+
+// pperft <depth>: perft split over a number of threads, each on its own copy of the board. The moves of the first
+// two plies are the work items (one ply below depth 3), handed out one at a time so a thread that finishes early
+// takes the next one. Prints the nodes per second of every thread and of the whole run
+void runParallelPerft(const Board& board, int depth, int threads);
+
+#endif // PERFT_H